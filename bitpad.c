@@ -15,12 +15,44 @@
 #include <time.h>
 #include <stdarg.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /***    defines    ***/
 #define CTRL_KEY(k) ((k) & 0x1f)
 #define KILO_VERSION "0.0.1"
 #define KILO_TAB_STOP 8
 #define KILO_QUIT_TIMES 3
+#define INDEX_MAGIC "BPIDX02" // bump when the sidecar layout changes
+#define JOURNAL_MAGIC "BPJRNL1"
+#define SAVE_CHUNK (1 << 20) // rows are streamed to disk through a buffer this big
+#ifndef MAP_NORESERVE // not on every platform, it only affects memory accounting
+#define MAP_NORESERVE 0
+#endif
+#define NAV_BLOCK 64 // rows per leaf of the navigation tree
+#define HEX_ROW_BYTES 16
+#define HEX_SNIFF_BYTES 8192 // a NUL byte in this much of the head makes a file binary
+#define SERVER_MAGIC "BPSRV01"
+#define BUFFER_BUDGET_MB 1024 // default memory all loaded buffers may use together
+#define STATS_PAGE 4096 // render widths per page of the width histogram
+#define DISK_CHUNK (1 << 20) // the file is hashed in runs of whole lines about this big
+#define CSV_MAX_WIDTH 40      // wider cells are cut off in the column view
+#define CSV_SAMPLE 1000       // rows looked at to size the columns
+#define CSV_THREAD_ROWS 65536 // rows per indexing thread, fewer aren't worth a thread
+#define CSV_MAX_THREADS 16
+#define CSV_SEP " | "
+#define CSV_SEP_LEN 3
 
 enum editorKey // value 1000 to ensure no conflict with ordinary keypresses
 {
@@ -33,18 +65,109 @@ enum editorKey // value 1000 to ensure no conflict with ordinary keypresses
     HOME_KEY,
     END_KEY,
     PAGE_UP,
-    PAGE_DOWN
+    PAGE_DOWN,
+    SHIFT_ARROW_UP, // <esc>[1;2A, adds a cursor on the row above
+    SHIFT_ARROW_DOWN,
+    SHIFT_TAB // <esc>[Z
 };
 
 /***    data    ***/
+struct navSum // bracket nesting of a span of text, per kind: () [] {}
+{
+    int delta[3];  // openers - closers
+    int minpre[3]; // lowest depth reached scanning the span from depth 0 (<= 0)
+};
+
 typedef struct erow // editor row
 {
     int size;
     int rsize; // render size
     char *chars;
-    char *render;
+    char *render; // NULL while dropped (inactive buffers), rebuilt from chars on use
+    int nbytes; // size as last counted in E.stats (size changes before the row is re-rendered), -1 if not counted yet
+    int words;  // word count of this row, kept so document totals can be updated by delta
+    int nchars; // utf-8 characters (bytes that are not continuation bytes)
+    long long diskoff; // where this row sits in the file on disk, -1 once it differs from chars + '\n'
+    int disklen;       // on-disk line length incl. terminator as of the last load/save, -1 for new rows
+    struct navSum br;  // bracket summary, feeds the navigation tree
+    int *fields;       // column view: offset in chars where each field starts, NULL when it's off
+    int nfields;
 } erow;
 
+struct editorStats // document totals, maintained incrementally by the row operations
+{
+    long long bytes; // sum of row sizes, newlines are added on display
+    long long words;
+    long long chars;
+    int maxwidth;    // longest render width
+    int **widthpages; // widthpages[w / STATS_PAGE][w % STATS_PAGE] = no. of rows of render width w, pages allocated on first use
+    int *pagerows;    // rows counted in each page
+    int npages;
+};
+
+struct navNode // summary of a run of rows
+{
+    long long bytes; // incl. one newline per row
+    int rows;
+    struct navSum br;
+};
+
+struct editorNav // segment tree over blocks of about NAV_BLOCK rows, for jumps by byte offset and bracket matching
+{
+    int valid; // bulk row changes (reload, sort) drop the tree, it is rebuilt on next use
+    int leaves; // power of two >= no. of blocks
+    int blocks; // leaves in use, the rest are empty
+    struct navNode *tree; // tree[1] is the root, tree[leaves + b] is block b
+};
+
+typedef struct foldNode // a folded range: row start stays visible, rows start+1..end are hidden
+{
+    int start, end;
+    int prio;   // treap heap priority
+    int hidden; // rows hidden by this subtree
+    int shift;  // pending row shift for the children
+    struct foldNode *left, *right;
+} foldNode;
+
+struct editorCursor
+{
+    int cx, cy;
+};
+
+struct hexPatch // bytes changed in the mapping, written back with pwrite on save
+{
+    long long off, len;
+};
+
+struct editorHex // hex view: rows are computed from the byte offset, nothing is copied
+{
+    int active;
+    int fd;
+    int readonly;
+    unsigned char *map; // MAP_PRIVATE, so patches stay in memory until saved
+    long long size;
+    int nibble; // 0 = high, 1 = low half of the byte under the cursor
+    struct hexPatch *patches;
+    int npatches;
+    int patchcap;
+};
+
+struct diskChunk // a run of whole lines of the file as of the last load/save, to spot changes by others
+{
+    long long off, len;
+    int firstrow, nrows; // rows holding its lines
+    uint64_t hash;
+};
+
+struct editorCsv // column view of delimited data
+{
+    int active;
+    char delim;
+    int ncols;   // most fields seen in the sampled rows
+    int *widths; // sampled width of each of those columns, capped at CSV_MAX_WIDTH
+    int *colstart; // render column where each of them starts, ncols + 1 entries
+};
+
 struct editorConfig // terminal stats
 {
     int cx, cy;
@@ -54,22 +177,84 @@ struct editorConfig // terminal stats
     int screenrows;
     int screencols;
     int numrows;
-    erow *row; // array to store multi lines
+    int rowcap; // allocated slots in row, grows geometrically
+    erow *row;  // array to store multi lines
     int dirty;
     char *filename;
+    char *indexpath; // sidecar line index for filename in the cache dir, NULL if unavailable
+    int dirtyfirst, dirtylast; // rows that may differ from the file on disk since the last load/save, -1 if none
+    long long disksize;        // file size as of the last load/save, -1 if the buffer has no file yet
+    int disknumrows;
+    int rowsmoved; // rows were inserted, deleted or reordered since the last load/save: row j may not be line j on disk
+    struct timespec diskmtime;
+    struct diskChunk *chunks; // cover the whole file in order
+    int nchunks, chunkcap;
+    int diskwarned; // told the user the file changed under unsaved edits
+    struct editorHex hex;
+    struct editorNav nav;
+    foldNode *folds; // treap of disjoint folds keyed by start; rowoff counts visible rows
+    struct editorCursor *cursors; // extra cursors besides cx/cy, sorted by (cy, cx), no duplicates
+    int ncursors;
+    int cursorcap;
+    struct editorStats stats;
+    long long renderbytes; // heap held by render strings, for the memory budget
+    struct editorCsv csv;
     char statusmsg[80];
     time_t statusmsg_time;
+    int syncoutput; // terminal supports synchronized output (DEC mode 2026)
+    int infd, outfd; // the terminal, or a client connection in server mode
+    int server;      // serving a client: read errors/EOF and quit end the session instead of the process
     struct termios orig_termios;
 };
 
 struct editorConfig E;
+jmp_buf sessionEnd; // server mode: where a session returns to when its client leaves
+int serverlfd = -1;  // server mode: the listening socket, watched during a session to turn others away
+char *promptbuf;     // editorPrompt's input so far, freed if the session ends in the middle of it
 
 /***    prototypes  ***/
 void editorSetStatusMessage(const char *fmt, ...);
 void editorRefreshScreen();
 char *editorPrompt(char *prompt);
+void editorNavUpdateRow(int at);
+void serverRefuseBusy();
+void editorNavRowInserted(int at);
+void editorNavRowDeleted(int at);
+void editorMoveCursor(int key);
+void editorFoldRowInserted(int at);
+void editorFoldRowDeleted(int at);
+int editorFoldVisToBuf(int v);
+int editorFoldBufToVis(int b);
+void editorCsvIndexRow(erow *row);
+void editorBufferOpen();
+void editorBufferNext();
+int editorBuffersDirty();
 
 /***    terminal    ***/
+// write all of buf, retrying on short writes, EINTR and EAGAIN. returns 0 or -1
+int editorWriteAll(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) // non-blocking pty is full, wait until it drains
+            {
+                struct pollfd pfd = {fd, POLLOUT, 0};
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
 // error handling
 void die(const char *s)
 {
@@ -118,33 +303,69 @@ void enableRawMode()
         die("tcsetattr");
 }
 
-int editorReadKey()
+int editorReadByte(char *c) // 1 if a byte arrived, 0 on timeout (~0.1s)
 {
     int nread;
-    char c;
 
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1)
+    if (!E.server)
     {
+        nread = read(E.infd, c, 1); // VMIN/VTIME make this time out by itself
         if (nread == -1 && errno != EAGAIN)
             die("read");
+        return nread == 1;
     }
 
+    struct pollfd pfd[2] = {{E.infd, POLLIN, 0}, {serverlfd, POLLIN, 0}};
+    int ready = poll(pfd, 2, 100);
+    if (ready == -1 && errno == EINTR)
+        return 0;
+    if (ready <= 0)
+        return 0;
+    if (pfd[1].revents & POLLIN) // someone else wants the server while this session runs
+        serverRefuseBusy();
+    if (!(pfd[0].revents & (POLLIN | POLLHUP | POLLERR)))
+        return 0;
+    nread = read(E.infd, c, 1);
+    if (nread != 1) // client hung up
+        longjmp(sessionEnd, 1);
+    return 1;
+}
+
+int editorReadKey()
+{
+    char c;
+
+    while (!editorReadByte(&c))
+        ;
+
     if (c == '\x1b') // we are aliasing arrow keys to wsad
     {
         char seq[3]; // using 3 bytes
 
-        if (read(STDIN_FILENO, &seq[0], 1) != 1) // read
+        if (!editorReadByte(&seq[0])) // read
             return '\x1b';
-        if (read(STDIN_FILENO, &seq[1], 1) != 1) // read
+        if (!editorReadByte(&seq[1])) // read
             return '\x1b';
 
         if (seq[0] == '[')
         {
             if (seq[1] >= '0' && seq[1] <= '9')
             {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1)
-                    return '\x1b';
-                if (seq[2] == '~')
+                char params[16]; // <esc>[<params><final>, e.g. 5~ or 8;24;80t
+                unsigned int n = 0;
+                params[n++] = seq[1];
+                while (1)
+                {
+                    if (!editorReadByte(&seq[2]))
+                        return '\x1b';
+                    if (seq[2] >= 0x40 && seq[2] <= 0x7e) // final byte
+                        break;
+                    if (n < sizeof(params) - 1)
+                        params[n++] = seq[2];
+                }
+                params[n] = '\0';
+
+                if (seq[2] == '~' && n == 1)
                 {
                     switch (seq[1])
                     {
@@ -164,6 +385,18 @@ int editorReadKey()
                         return END_KEY;
                     }
                 }
+                else if (strcmp(params, "1;2") == 0 && (seq[2] == 'A' || seq[2] == 'B')) // shift + arrow
+                    return seq[2] == 'A' ? SHIFT_ARROW_UP : SHIFT_ARROW_DOWN;
+                else if (seq[2] == 't') // <esc>[8;rows;colst, window size report sent by a client on resize
+                {
+                    int rows, cols;
+                    if (sscanf(params, "8;%d;%d", &rows, &cols) == 2 && rows > 2 && cols > 0)
+                    {
+                        E.screenrows = rows - 2;
+                        E.screencols = cols;
+                    }
+                    return CTRL_KEY('l');
+                }
             }
             else
             {
@@ -181,6 +414,8 @@ int editorReadKey()
                     return HOME_KEY;
                 case 'F':
                     return END_KEY;
+                case 'Z':
+                    return SHIFT_TAB;
                 }
             }
         }
@@ -249,8 +484,125 @@ int getWindowSize(int *rows, int *cols)
     }
 }
 
+/*ask the terminal whether it knows DEC mode 2026 (synchronized output).
+DECRQM reply is <esc>[?2026;<n>$y; n = 1..4 means recognized. the trailing DA1 query
+(<esc>[c) is answered by every terminal, so we stop reading as soon as its 'c' arrives
+instead of waiting on terminals that ignore DECRQM*/
+int editorDetectSyncOutput()
+{
+    char buf[64];
+    unsigned int i = 0;
+
+    if (editorWriteAll(STDOUT_FILENO, "\x1b[?2026$p\x1b[c", 12) == -1)
+        return 0;
+
+    while (i < sizeof(buf) - 1)
+    {
+        if (read(STDIN_FILENO, &buf[i], 1) != 1) // VTIME timeout, terminal went quiet
+            break;
+        if (buf[i] == 'c')
+            break;
+        i++;
+    }
+    buf[i] = '\0';
+
+    char *p = strstr(buf, "\x1b[?2026;");
+    if (!p)
+        return 0;
+    int mode = p[8] - '0';
+    return mode >= 1 && mode <= 3; // 0 = unknown mode, 4 = permanently reset
+}
+
+/***    document stats  ***/
+
+void editorStatsAddRow(erow *row)
+{
+    struct editorStats *st = &E.stats;
+    int w = row->rsize;
+    int page = w / STATS_PAGE;
+
+    row->nbytes = row->size;
+    st->bytes += row->nbytes;
+    st->words += row->words;
+    st->chars += row->nchars;
+
+    if (page >= st->npages)
+    {
+        st->widthpages = realloc(st->widthpages, sizeof(int *) * (page + 1));
+        st->pagerows = realloc(st->pagerows, sizeof(int) * (page + 1));
+        if (st->widthpages == NULL || st->pagerows == NULL)
+            die("realloc");
+        memset(&st->widthpages[st->npages], 0, sizeof(int *) * (page + 1 - st->npages));
+        memset(&st->pagerows[st->npages], 0, sizeof(int) * (page + 1 - st->npages));
+        st->npages = page + 1;
+    }
+    if (st->widthpages[page] == NULL)
+    {
+        st->widthpages[page] = calloc(STATS_PAGE, sizeof(int));
+        if (st->widthpages[page] == NULL)
+            die("calloc");
+    }
+    st->widthpages[page][w % STATS_PAGE]++;
+    st->pagerows[page]++;
+
+    if (w > st->maxwidth)
+        st->maxwidth = w;
+}
+
+void editorStatsRemoveRow(erow *row)
+{
+    struct editorStats *st = &E.stats;
+    int w = row->rsize;
+    int page = w / STATS_PAGE;
+
+    st->bytes -= row->nbytes;
+    st->words -= row->words;
+    st->chars -= row->nchars;
+
+    st->widthpages[page][w % STATS_PAGE]--;
+    st->pagerows[page]--;
+
+    if (w != st->maxwidth)
+        return;
+
+    /*the longest row shrank or went away: look for the new maximum. empty pages
+    are skipped by their row count, then the page holding the max is walked down.
+    that is at most one page plus the pages the max grew through*/
+    if (st->pagerows[page] == 0)
+    {
+        while (page > 0 && st->pagerows[page] == 0)
+            page--;
+        if (st->pagerows[page] == 0) // no rows left
+        {
+            st->maxwidth = 0;
+            return;
+        }
+        w = page * STATS_PAGE + STATS_PAGE - 1;
+    }
+    while (w > page * STATS_PAGE && st->widthpages[page][w % STATS_PAGE] == 0)
+        w--;
+    st->maxwidth = w;
+}
+
 /***    row operations  ***/
 
+void editorMarkDirty(int at) // row at no longer matches the file on disk
+{
+    if (E.dirtyfirst == -1 || at < E.dirtyfirst)
+        E.dirtyfirst = at;
+    if (at > E.dirtylast)
+        E.dirtylast = at;
+}
+
+void editorDiskSynced() // rows were just loaded from / written to disk, only rows not byte-identical there stay dirty
+{
+    int j;
+    E.dirtyfirst = E.dirtylast = -1;
+    for (j = 0; j < E.numrows; j++)
+        if (E.row[j].diskoff == -1 || E.row[j].disklen != E.row[j].size + 1) // CRLF or missing final newline
+            editorMarkDirty(j);
+}
+
 int editorRowCxToRx(erow *row, int cx)
 {
     int rx = 0;
@@ -264,7 +616,24 @@ int editorRowCxToRx(erow *row, int cx)
     return rx;
 }
 
-void editorUpdateRow(erow *row) // copy chars in render string
+int bracketKind(int c) // 0 = (), 1 = [], 2 = {}, -1 = not a bracket
+{
+    switch (c)
+    {
+    case '(':
+    case ')':
+        return 0;
+    case '[':
+    case ']':
+        return 1;
+    case '{':
+    case '}':
+        return 2;
+    }
+    return -1;
+}
+
+void editorRenderRow(erow *row) // copy chars in render string
 {
     int tabs = 0;
     int j;
@@ -273,6 +642,8 @@ void editorUpdateRow(erow *row) // copy chars in render string
         if (row->chars[j] == '\t')
             tabs++;
 
+    if (row->render)
+        E.renderbytes -= row->rsize + 1;
     free(row->render);
     row->render = malloc(row->size + tabs * (KILO_TAB_STOP - 1) + 1);
 
@@ -291,6 +662,82 @@ void editorUpdateRow(erow *row) // copy chars in render string
 
     row->render[idx] = '\0';
     row->rsize = idx;
+    E.renderbytes += row->rsize + 1;
+}
+
+char *editorRowRender(erow *row) // render of a row, rebuilt if it was dropped
+{
+    if (!row->render)
+        editorRenderRow(row);
+    return row->render;
+}
+
+void editorUpdateRow(erow *row) // recount and re-render a row after its chars changed
+{
+    int j;
+
+    if (row->nbytes >= 0) // row is already counted in the totals, take its old contribution out
+        editorStatsRemoveRow(row);
+
+    row->diskoff = -1;
+    editorMarkDirty(row - E.row);
+
+    int depth[3] = {0, 0, 0};
+    memset(&row->br, 0, sizeof(row->br));
+
+    row->words = 0;
+    row->nchars = 0;
+    for (j = 0; j < row->size; j++)
+    {
+        unsigned char c = row->chars[j];
+        int k = bracketKind(c);
+        if (k >= 0)
+        {
+            depth[k] += strchr("([{", c) ? 1 : -1;
+            if (depth[k] < row->br.minpre[k])
+                row->br.minpre[k] = depth[k];
+        }
+        if ((c & 0xC0) != 0x80)
+            row->nchars++;
+        if (!isspace(c) && (j == 0 || isspace((unsigned char)row->chars[j - 1])))
+            row->words++;
+    }
+
+    editorRenderRow(row);
+
+    memcpy(row->br.delta, depth, sizeof(depth));
+    editorStatsAddRow(row);
+    if (E.nav.valid)
+        editorNavUpdateRow(row - E.row);
+    if (E.csv.active)
+        editorCsvIndexRow(row);
+}
+
+void editorReserveRows(int n) // grow E.row to hold at least n rows
+{
+    if (n <= E.rowcap)
+        return;
+    E.row = realloc(E.row, sizeof(erow) * n);
+    if (E.row == NULL)
+        die("realloc");
+    E.rowcap = n;
+}
+
+void editorInitRow(erow *row, const char *s, size_t len) // fill a fresh slot in E.row
+{
+    row->size = len;
+    row->chars = malloc(len + 1);
+    memcpy(row->chars, s, len);
+    row->chars[len] = '\0';
+
+    row->diskoff = -1;
+    row->disklen = -1;
+    row->fields = NULL;
+    row->nfields = 0;
+    row->rsize = 0;     // initialising rsize
+    row->render = NULL; // initialising render
+    row->nbytes = -1;   // not counted in E.stats yet
+    editorUpdateRow(row);
 }
 
 void editorInsertRow(int at, char *s, size_t len)
@@ -298,19 +745,24 @@ void editorInsertRow(int at, char *s, size_t len)
     if (at < 0 || at > E.numrows)
         return;
 
-    E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
+    if (E.numrows == E.rowcap)
+        editorReserveRows(E.rowcap ? E.rowcap * 2 : 16);
     memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
 
-    E.row[at].size = len;
-    E.row[at].chars = malloc(len + 1);
-    memcpy(E.row[at].chars, s, len);
-    E.row[at].chars[len] = '\0';
-
-    E.row[at].rsize = 0;     // initialising rsize
-    E.row[at].render = NULL; // initialising render
-    editorUpdateRow(&E.row[at]);
+    if (E.dirtylast >= at) // rows below shift down by one
+        E.dirtylast++;
+    int nav = E.nav.valid;
+    E.nav.valid = 0; // the tree doesn't know the new row yet, don't let editorUpdateRow touch it
+    editorFoldRowInserted(at);
+    editorInitRow(&E.row[at], s, len);
 
     E.numrows++; // keep track of the no. of lines
+    E.rowsmoved = 1;
+    if (nav)
+    {
+        E.nav.valid = 1;
+        editorNavRowInserted(at);
+    }
     E.dirty++;   // tracking changes made, incrementing for quantitativity
 }
 
@@ -318,6 +770,7 @@ void editorFreeRow(erow *row)
 {
     free(row->render);
     free(row->chars);
+    free(row->fields);
 }
 
 void editorDelRow(int at)
@@ -325,9 +778,19 @@ void editorDelRow(int at)
     if (at < 0 || at >= E.numrows)
         return;
 
+    editorStatsRemoveRow(&E.row[at]);
+    if (E.row[at].render)
+        E.renderbytes -= E.row[at].rsize + 1;
     editorFreeRow(&E.row[at]);
     memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
     E.numrows--;
+    E.rowsmoved = 1;
+    if (E.nav.valid)
+        editorNavRowDeleted(at);
+    editorFoldRowDeleted(at);
+    if (E.dirtylast > at)
+        E.dirtylast--;
+    editorMarkDirty(at); // may be == numrows when the last row went, the file just gets shorter
     E.dirty++;
 }
 
@@ -343,6 +806,7 @@ void editorRowInsertChar(erow *row, int at, int c) // at is index at which char
     row->chars[at] = c;
 
     editorUpdateRow(row); // to update render and rsize
+    E.dirty++;
 }
 
 void editorRowDelChar(erow *row, int at)
@@ -426,146 +890,3039 @@ void editorDelChar()
     }
 }
 
-/***    file i/o    ***/
+/***    line index cache    ***/
+/*for every file we open, a sidecar in $XDG_CACHE_HOME/bitpad (or ~/.cache/bitpad)
+records where each line starts plus the last cursor position. it is keyed by
+path, size, mtime and inode, so a reopen of an unchanged file can cut rows
+straight out of an mmap of the file without looking at its bytes at all.
+per line it stores, as LEB128 varints, the length (terminator included) and
+what counting the line would give: words, bytes that aren't characters, extra
+width from tabs and the bracket summary; ~5 bytes for a plain ascii line*/
 
-char *editorRowsToString(int *buflen)
+struct indexHeader
 {
-    int totlen = 0;
-    int j;
+    char magic[8];
+    uint64_t size;
+    int64_t mtime_sec, mtime_nsec;
+    uint64_t ino, dev;
+    uint64_t numlines;
+    int64_t cy, cx, rowoff; // where the user left off
+    uint64_t datalen;       // bytes of varint data following the header
+};
 
-    for (j = 0; j < E.numrows; j++) // length of string to store row contents
-        totlen += E.row[j].size + 1;
+struct lineIndex // varint-encoded line summaries while building an index
+{
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+    uint64_t numlines;
+};
 
-    *buflen = totlen;
-    char *buf = malloc(totlen);
-    char *p = buf;
+void lineIndexPut(struct lineIndex *li, uint64_t v)
+{
+    if (li->len + 10 > li->cap) // a 64 bit varint is at most 10 bytes
+    {
+        li->cap = li->cap ? li->cap * 2 : 4096;
+        li->data = realloc(li->data, li->cap);
+        if (li->data == NULL)
+            die("realloc");
+    }
 
-    for (j = 0; j < E.numrows; j++) // storing the content user entered into p
+    while (v >= 0x80)
     {
-        memcpy(p, E.row[j].chars, E.row[j].size);
-        p += E.row[j].size; // pointer points to end of row
-        *p = '\n';          // insert new line at end
-        p++;                // pointer moved to start new row
+        li->data[li->len++] = (v & 0x7f) | 0x80;
+        v >>= 7;
     }
+    li->data[li->len++] = v;
+}
 
-    return buf;
+uint64_t zigzag(int v) // small negative depths stay one byte
+{
+    return v < 0 ? ((uint64_t)-(int64_t)v << 1) - 1 : (uint64_t)v << 1;
 }
 
-void editorOpen(char *filename)
+int unzigzag(uint64_t v)
 {
-    free(E.filename);
-    E.filename = strdup(filename); // also allocates required amt of memory that u freed
+    return v & 1 ? -(int)((v + 1) >> 1) : (int)(v >> 1);
+}
 
-    FILE *fp = fopen(filename, "r"); // open file in read mode
-    if (!fp)
-        die("fopen"); // error handling
+void lineIndexAppend(struct lineIndex *li, erow *row, uint64_t linelen) // row as it sits on disk in linelen bytes
+{
+    int k, brackets = 0;
+
+    lineIndexPut(li, linelen);
+    lineIndexPut(li, row->words);
+    lineIndexPut(li, row->size - row->nchars);
+    lineIndexPut(li, row->rsize - row->size);
+    for (k = 0; k < 3; k++)
+        if (row->br.delta[k] || row->br.minpre[k])
+            brackets = 1;
+    lineIndexPut(li, brackets);
+    if (brackets)
+        for (k = 0; k < 3; k++)
+        {
+            lineIndexPut(li, zigzag(row->br.delta[k]));
+            lineIndexPut(li, zigzag(row->br.minpre[k]));
+        }
+    li->numlines++;
+}
 
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen; // signed size_t. it can return -1 when error
+int lineIndexGet(const unsigned char *data, size_t len, size_t *p, uint64_t *v) // -1 if the stream ran out
+{
+    int shift = 0;
 
-    while ((linelen = getline(&line, &linecap, fp)) != -1) // parse file line by line, getline returns -1 at EOF
+    *v = 0;
+    while (*p < len && shift < 64)
     {
-        while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) // we're stripping carriage and newline cuz erow reps one line of text
-            linelen--;
-        editorInsertRow(E.numrows, line, linelen);
+        unsigned char b = data[(*p)++];
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+        if (!(b & 0x80))
+            return 0;
     }
+    return -1;
+}
 
-    free(line);
-    fclose(fp);
-    E.dirty = 0; // initialising doesnt count as a change
+void indexKeyFromStat(struct indexHeader *h, struct stat *st)
+{
+    h->size = st->st_size;
+    h->mtime_sec = st->st_mtim.tv_sec;
+    h->mtime_nsec = st->st_mtim.tv_nsec;
+    h->ino = st->st_ino;
+    h->dev = st->st_dev;
 }
 
-void editorSave() // mapped to ctl+s
+int indexKeyMatches(struct indexHeader *h, struct stat *st)
 {
-    if (E.filename == NULL)
-    {
-        E.filename = editorPrompt("Save as: %s (ESC to cancel)");
+    struct indexHeader k;
+    indexKeyFromStat(&k, st);
+    return memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) == 0 &&
+           h->size == k.size && h->mtime_sec == k.mtime_sec && h->mtime_nsec == k.mtime_nsec &&
+           h->ino == k.ino && h->dev == k.dev;
+}
 
-        if (E.filename == NULL)
-        {
-            editorSetStatusMessage("Save aborted");
-            return;
-        }
-    }
+char *editorIndexPath(const char *filename) // cache file for filename, creating the cache dir. NULL if no cache
+{
+    char dir[PATH_MAX], abspath[PATH_MAX];
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
 
-    int len;
-    char *buf = editorRowsToString(&len);
+    if (realpath(filename, abspath) == NULL)
+        return NULL;
 
-    int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
+    if (xdg && *xdg)
+    {
+        mkdir(xdg, 0700);
+        snprintf(dir, sizeof(dir), "%s/bitpad", xdg);
+    }
+    else if (home && *home)
+    {
+        snprintf(dir, sizeof(dir), "%s/.cache", home);
+        mkdir(dir, 0700);
+        snprintf(dir, sizeof(dir), "%s/.cache/bitpad", home);
+    }
+    else
+        return NULL;
 
-    /*Saving users inputs to file he's provided*/
-    if (fd != -1)
+    if (mkdir(dir, 0700) == -1 && errno != EEXIST)
+        return NULL;
+
+    uint64_t h = 14695981039346656037ULL; // FNV-1a of the absolute path names the sidecar
+    char *p;
+    for (p = abspath; *p; p++)
     {
-        if (ftruncate(fd, len) != -1)
-        {
-            if (write(fd, buf, len) == len)
-            {
-                close(fd);
-                free(buf);
-                E.dirty = 0; // reseting count of changes
-                editorSetStatusMessage("%d bytes written to disk", len);
-                return;
-            }
-        }
-        close(fd);
+        h ^= (unsigned char)*p;
+        h *= 1099511628211ULL;
     }
 
-    free(buf);
-    editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+    char *path = malloc(strlen(dir) + 32);
+    sprintf(path, "%s/%016llx.idx", dir, (unsigned long long)h);
+    return path;
 }
-/***    append buffer   ***/
-struct abuf
+
+// write a fresh index for the file as it was at st. written to a temp file and renamed so readers never see half of it
+void editorIndexWrite(struct stat *st, struct lineIndex *li)
 {
-    char *b;
-    int len;
-};
+    struct indexHeader h;
 
-#define ABUF_INIT {NULL, 0}
+    if (!E.indexpath || st == NULL)
+        return;
 
-void abAppend(struct abuf *ab, const char *s, int len) // append all write fncs to buffer
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, INDEX_MAGIC, sizeof(h.magic));
+    indexKeyFromStat(&h, st);
+    h.numlines = li->numlines;
+    h.cy = E.cy;
+    h.cx = E.cx;
+    h.rowoff = editorFoldVisToBuf(E.rowoff); // folds aren't persisted, store a buffer row
+    h.datalen = li->len;
+
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", E.indexpath, (int)getpid());
+
+    int ifd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (ifd == -1)
+        return;
+
+    if (editorWriteAll(ifd, (char *)&h, sizeof(h)) == 0 &&
+        editorWriteAll(ifd, (char *)li->data, li->len) == 0 &&
+        close(ifd) == 0)
+    {
+        if (rename(tmp, E.indexpath) == 0)
+            return;
+    }
+    else
+        close(ifd);
+    unlink(tmp);
+}
+
+void editorIndexSaveCursor() // remember where we were, if the index still describes the file on disk
 {
-    char *new = realloc(ab->b, ab->len + len);
+    struct indexHeader h;
+    struct stat st;
 
-    if (new == NULL)
+    if (!E.indexpath || !E.filename || stat(E.filename, &st) == -1)
         return;
 
-    memcpy(&new[ab->len], s, len);
+    int ifd = open(E.indexpath, O_RDWR);
+    if (ifd == -1)
+        return;
 
-    ab->b = new;
-    ab->len += len;
+    if (pread(ifd, &h, sizeof(h), 0) == sizeof(h) && indexKeyMatches(&h, &st))
+    {
+        h.cy = E.cy;
+        h.cx = E.cx;
+        h.rowoff = editorFoldVisToBuf(E.rowoff);
+        pwrite(ifd, &h, sizeof(h), 0);
+    }
+    close(ifd);
 }
 
-void abFree(struct abuf *ab) // destructor that deallocates dyn mem used by abuf
+// a save left every line length unchanged: point the existing index at the new file instead of rebuilding it
+int editorIndexRekey(int fd, struct stat *old)
 {
-    free(ab->b);
+    struct indexHeader h;
+    struct stat st;
+    int ok = -1;
+
+    if (!E.indexpath || fstat(fd, &st) == -1)
+        return -1;
+
+    int ifd = open(E.indexpath, O_RDWR);
+    if (ifd == -1)
+        return -1;
+
+    if (pread(ifd, &h, sizeof(h), 0) == sizeof(h) && indexKeyMatches(&h, old))
+    {
+        indexKeyFromStat(&h, &st);
+        h.cy = E.cy;
+        h.cx = E.cx;
+        h.rowoff = editorFoldVisToBuf(E.rowoff);
+        if (pwrite(ifd, &h, sizeof(h), 0) == sizeof(h))
+            ok = 0;
+    }
+    close(ifd);
+    return ok;
 }
 
-/***    output  ***/
-void editorScroll()
+// fast path for editorOpen: load rows of fd, as it was at st, using the cached line starts. returns 0, or -1 if the index is stale/missing
+int editorIndexLoad(int fd, struct stat *st)
 {
-    E.rx = 0;
-    if (E.cy < E.numrows)
+    struct indexHeader h;
+
+    if (!E.indexpath)
+        return -1;
+
+    int ifd = open(E.indexpath, O_RDONLY);
+    if (ifd == -1)
+        return -1;
+
+    if (pread(ifd, &h, sizeof(h), 0) != sizeof(h) || !indexKeyMatches(&h, st) || h.numlines > INT_MAX)
     {
-        E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+        close(ifd);
+        return -1;
     }
 
-    if (E.cy < E.rowoff)
+    unsigned char *data = malloc(h.datalen ? h.datalen : 1);
+    if (pread(ifd, data, h.datalen, sizeof(h)) != (ssize_t)h.datalen)
     {
-        E.rowoff = E.cy;
+        free(data);
+        close(ifd);
+        return -1;
     }
-    if (E.cy >= E.rowoff + E.screenrows)
+    close(ifd);
+
+    char *map = NULL;
+    if (h.size > 0)
     {
-        E.rowoff = E.cy - E.screenrows + 1;
+        map = mmap(NULL, h.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            free(data);
+            return -1;
+        }
+        madvise(map, h.size, MADV_SEQUENTIAL);
     }
-    if (E.rx < E.coloff)
+
+    editorReserveRows(h.numlines);
+
+    /*rows are filled in from the stored counts: no per byte work, and no render
+    until a row is drawn. the chars still have to be copied out of the map*/
+    uint64_t off = 0;
+    size_t p = 0;
+    uint64_t i;
+    for (i = 0; i < h.numlines; i++)
     {
-        E.coloff = E.rx;
-    }
+        uint64_t linelen, words, nonchars, tabwidth, brackets, v[6];
+        int k;
+
+        if (lineIndexGet(data, h.datalen, &p, &linelen) == -1 || lineIndexGet(data, h.datalen, &p, &words) == -1 ||
+            lineIndexGet(data, h.datalen, &p, &nonchars) == -1 || lineIndexGet(data, h.datalen, &p, &tabwidth) == -1 ||
+            lineIndexGet(data, h.datalen, &p, &brackets) == -1)
+            break;
+        for (k = 0; brackets && k < 6; k++)
+            if (lineIndexGet(data, h.datalen, &p, &v[k]) == -1)
+                break;
+        if (k < 6 && brackets)
+            break;
+        if (linelen == 0 || off + linelen > h.size) // corrupt index, start over with a real scan
+            break;
+
+        uint64_t len = linelen;
+        while (len > 0 && (map[off + len - 1] == '\n' || map[off + len - 1] == '\r'))
+            len--;
+        if (nonchars > len || words > len || tabwidth > len * (KILO_TAB_STOP - 1))
+            break;
+
+        erow *row = &E.row[E.numrows++];
+        memset(row, 0, sizeof(*row));
+        row->size = len;
+        row->chars = malloc(len + 1);
+        memcpy(row->chars, &map[off], len);
+        row->chars[len] = '\0';
+        row->words = words;
+        row->nchars = len - nonchars;
+        row->rsize = len + tabwidth; // render stays NULL, editorRowRender builds it when it's drawn
+        for (k = 0; brackets && k < 3; k++)
+        {
+            row->br.delta[k] = unzigzag(v[2 * k]);
+            row->br.minpre[k] = unzigzag(v[2 * k + 1]);
+        }
+        row->diskoff = off;
+        row->disklen = linelen;
+        row->nbytes = -1;
+        editorStatsAddRow(row);
+        off += linelen;
+    }
+
+    if (map)
+        munmap(map, h.size);
+    free(data);
+
+    if (i < h.numlines || off != h.size) // lines must account for every byte of the file
+    {
+        while (E.numrows > 0)
+            editorDelRow(E.numrows - 1);
+        return -1;
+    }
+
+    if (h.cy >= 0 && h.cy <= E.numrows) // put the cursor back where the user left it
+    {
+        E.cy = h.cy;
+        E.rowoff = (h.rowoff >= 0 && h.rowoff <= h.cy) ? h.rowoff : h.cy;
+        E.cx = (E.cy < E.numrows && h.cx >= 0 && h.cx <= E.row[E.cy].size) ? h.cx : 0;
+    }
+    return 0;
+}
+
+/***    partial save    ***/
+/*a save normally touches only the rows that changed. every row remembers its
+offset on disk; rows outside [dirtyfirst, dirtylast] are known to still sit at
+that offset, so only the changed rows (and, if the length changed, the rows
+after them) have to be written. before overwriting anything the old bytes go to
+<file>.bitpad-journal, which editorOpen replays if we die halfway through*/
+
+int editorPwriteAll(int fd, const char *buf, size_t len, off_t off)
+{
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, buf, len, off);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+        off += n;
+    }
+    return 0;
+}
+
+int editorWriteRows(int fd, int from, int to, off_t off) // stream rows [from, to) joined by \n to fd at off
+{
+    char *buf = malloc(SAVE_CHUNK);
+    size_t used = 0;
+    int j;
+
+    if (buf == NULL)
+        return -1;
+
+    for (j = from; j < to; j++)
+    {
+        erow *row = &E.row[j];
+
+        if (used > 0 && used + row->size + 1 > SAVE_CHUNK)
+        {
+            if (editorPwriteAll(fd, buf, used, off) == -1)
+                break;
+            off += used;
+            used = 0;
+        }
+
+        if (row->size + 1 > SAVE_CHUNK) // row bigger than the buffer, write it straight from chars
+        {
+            if (editorPwriteAll(fd, row->chars, row->size, off) == -1 ||
+                editorPwriteAll(fd, "\n", 1, off + row->size) == -1)
+                break;
+            off += row->size + 1;
+            continue;
+        }
+
+        memcpy(&buf[used], row->chars, row->size);
+        used += row->size;
+        buf[used++] = '\n';
+    }
+
+    int ret = (j == to && editorPwriteAll(fd, buf, used, off) == 0) ? 0 : -1;
+    free(buf);
+    return ret;
+}
+
+struct saveExtent
+{
+    long long off, len; // bytes of the new file to write
+    int from, to;       // rows [from, to) that make up those bytes
+};
+
+char *editorJournalPath(const char *filename)
+{
+    char *path = malloc(strlen(filename) + 16);
+    sprintf(path, "%s.bitpad-journal", filename);
+    return path;
+}
+
+// plan the extents a save has to write. returns their count, or -1 if the whole file must be rewritten
+int editorPlanSave(struct stat *st, struct saveExtent **out, int *samelines)
+{
+    struct saveExtent *ex = NULL;
+    int n = 0, cap = 0;
+    long long cur;
+    int j;
+
+    if (E.disksize < 0 || st->st_size != E.disksize ||
+        st->st_mtim.tv_sec != E.diskmtime.tv_sec || st->st_mtim.tv_nsec != E.diskmtime.tv_nsec)
+        return -1; // not the file we loaded, we don't know what's on disk
+
+    int first = (E.dirtyfirst == -1 || E.dirtyfirst > E.numrows) ? E.numrows : E.dirtyfirst;
+    int last = E.dirtylast >= E.numrows ? E.numrows - 1 : E.dirtylast;
+
+    if (first == 0)
+        cur = 0;
+    else
+    {
+        erow *prev = &E.row[first - 1];
+        if (prev->diskoff == -1 || prev->disklen != prev->size + 1)
+            return -1;
+        cur = prev->diskoff + prev->disklen;
+    }
+
+    *samelines = (E.numrows == E.disknumrows && !E.rowsmoved);
+    for (j = first; j <= last || (j < E.numrows && j == last + 1); j++)
+    {
+        erow *row = &E.row[j];
+        int tail = j > last;
+
+        if (!tail && row->disklen != row->size + 1) // disklen is what the line at this position was (rows didn't move)
+            *samelines = 0;
+        if (row->diskoff == cur && row->disklen == row->size + 1) // untouched and not shifted
+        {
+            if (tail)
+                break; // and so is everything after it
+            cur += row->size + 1;
+            continue;
+        }
+
+        long long len = row->size + 1;
+        int to = j + 1;
+        if (tail) // rows after the change moved, rewrite them all
+        {
+            len = E.stats.bytes + E.numrows - cur;
+            to = E.numrows;
+        }
+
+        if (n > 0 && ex[n - 1].off + ex[n - 1].len == cur) // adjacent to the previous extent, extend it
+        {
+            ex[n - 1].len += len;
+            ex[n - 1].to = to;
+        }
+        else
+        {
+            if (n == cap)
+            {
+                cap = cap ? cap * 2 : 8;
+                ex = realloc(ex, sizeof(*ex) * cap);
+            }
+            ex[n].off = cur;
+            ex[n].len = len;
+            ex[n].from = j;
+            ex[n].to = to;
+            n++;
+        }
+        cur += len;
+        if (tail)
+            break;
+    }
+
+    long long total = 0;
+    for (j = 0; j < n; j++)
+        total += ex[j].len;
+    if (total * 2 > E.stats.bytes + E.numrows) // most of the file changed, a plain rewrite is just as cheap
+    {
+        free(ex);
+        return -1;
+    }
+
+    *out = ex;
+    return n;
+}
+
+/*journal layout: magic, old file length, record count, then for each record an
+offset, the length of old bytes saved and those bytes, then the magic again.
+there is a record per extent, plus one for the old tail when the file shrinks
+to newlen. a journal without the trailing magic was never finished, the file
+is untouched*/
+int editorJournalWrite(const char *jpath, int fd, struct saveExtent *ex, int n, long long newlen)
+{
+    int jfd = open(jpath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (jfd == -1)
+        return -1;
+
+    char *buf = malloc(SAVE_CHUNK);
+    int tail = newlen < E.disksize; // ftruncate drops [newlen, disksize)
+    int64_t hdr[2] = {E.disksize, n + tail};
+    int ok = buf != NULL && editorWriteAll(jfd, JOURNAL_MAGIC, 8) == 0 &&
+             editorWriteAll(jfd, (char *)hdr, sizeof(hdr)) == 0;
+    int j;
+
+    for (j = 0; ok && j < n + tail; j++)
+    {
+        int64_t rec[2] = {newlen, E.disksize - newlen};
+        if (j < n)
+        {
+            rec[0] = ex[j].off;
+            rec[1] = 0;
+            if (ex[j].off < E.disksize)
+                rec[1] = ex[j].off + ex[j].len > E.disksize ? E.disksize - ex[j].off : ex[j].len;
+        }
+        ok = editorWriteAll(jfd, (char *)rec, sizeof(rec)) == 0;
+
+        long long done = 0;
+        while (ok && done < rec[1])
+        {
+            long long chunk = rec[1] - done > SAVE_CHUNK ? SAVE_CHUNK : rec[1] - done;
+            ok = pread(fd, buf, chunk, rec[0] + done) == chunk &&
+                 editorWriteAll(jfd, buf, chunk) == 0;
+            done += chunk;
+        }
+    }
+
+    ok = ok && editorWriteAll(jfd, JOURNAL_MAGIC, 8) == 0 && fsync(jfd) == 0;
+    free(buf);
+    if (close(jfd) == -1 || !ok)
+    {
+        unlink(jpath);
+        return -1;
+    }
+    return 0;
+}
+
+int editorJournalRecover(const char *filename) // undo a partial save that was interrupted. -1 if a journal is still left
+{
+    char *jpath = editorJournalPath(filename);
+    int jfd = open(jpath, O_RDONLY);
+    if (jfd == -1)
+    {
+        free(jpath);
+        return 0;
+    }
+
+    char magic[8];
+    int64_t hdr[2];
+    off_t end = lseek(jfd, 0, SEEK_END);
+    int complete = end >= 8 + (off_t)sizeof(hdr) + 8 &&
+                   pread(jfd, magic, 8, end - 8) == 8 && memcmp(magic, JOURNAL_MAGIC, 8) == 0 &&
+                   pread(jfd, magic, 8, 0) == 8 && memcmp(magic, JOURNAL_MAGIC, 8) == 0 &&
+                   pread(jfd, hdr, sizeof(hdr), 8) == sizeof(hdr);
+
+    int fd = complete ? open(filename, O_RDWR) : -1;
+    if (fd != -1)
+    {
+        char *buf = malloc(SAVE_CHUNK);
+        off_t pos = 8 + sizeof(hdr);
+        int64_t j;
+        int ok = buf != NULL;
+
+        for (j = 0; ok && j < hdr[1]; j++)
+        {
+            int64_t rec[2];
+            ok = pread(jfd, rec, sizeof(rec), pos) == sizeof(rec);
+            pos += sizeof(rec);
+
+            long long done = 0;
+            while (ok && done < rec[1])
+            {
+                long long chunk = rec[1] - done > SAVE_CHUNK ? SAVE_CHUNK : rec[1] - done;
+                ok = pread(jfd, buf, chunk, pos) == chunk &&
+                     editorPwriteAll(fd, buf, chunk, rec[0] + done) == 0;
+                pos += chunk;
+                done += chunk;
+            }
+        }
+
+        if (ok && ftruncate(fd, hdr[0]) == 0 && fsync(fd) == 0)
+        {
+            editorSetStatusMessage("Rolled back an interrupted save of %s", filename);
+            complete = 0; // done with it
+        }
+        free(buf);
+        close(fd);
+    }
+
+    close(jfd);
+    if (!complete) // replayed, or never finished writing so the file was never touched
+        unlink(jpath);
+    free(jpath);
+    return complete ? -1 : 0;
+}
+
+void editorDiskStat(struct stat *st) // remember the snapshot of the file a load/save saw, NULL if unknown
+{
+    if (st == NULL)
+    {
+        E.disksize = -1;
+        return;
+    }
+    E.disksize = st->st_size;
+    E.diskmtime = st->st_mtim;
+    E.disknumrows = E.numrows;
+    E.rowsmoved = 0;
+}
+
+/***    hex view    ***/
+/*binary files are not split into rows at all: the file is mmapped and row n is
+just bytes [n * 16, n * 16 + 16), rendered when it is on screen. open is one
+mmap no matter the size, and only the pages we draw are ever read*/
+
+int editorIsBinary(int fd)
+{
+    char buf[HEX_SNIFF_BYTES];
+    ssize_t n = pread(fd, buf, sizeof(buf), 0);
+    return n > 0 && memchr(buf, '\0', n) != NULL;
+}
+
+int editorHexOpen(const char *filename) // 0 on success, -1 with errno set
+{
+    struct stat st;
+    struct editorHex *h = &E.hex;
+
+    h->readonly = 0;
+    h->fd = open(filename, O_RDWR);
+    if (h->fd == -1)
+    {
+        h->readonly = 1;
+        h->fd = open(filename, O_RDONLY);
+    }
+    if (h->fd == -1)
+        return -1;
+    if (fstat(h->fd, &st) == -1)
+    {
+        int err = errno;
+        close(h->fd);
+        h->fd = -1;
+        errno = err;
+        return -1;
+    }
+
+    if ((st.st_size + HEX_ROW_BYTES - 1) / HEX_ROW_BYTES > INT_MAX)
+    {
+        close(h->fd);
+        h->fd = -1;
+        errno = EFBIG;
+        return -1;
+    }
+
+    h->size = st.st_size;
+    h->map = NULL;
+    if (h->size > 0)
+    {
+        // NORESERVE: only pages we patch need backing, not the whole (possibly huge) file
+        h->map = mmap(NULL, h->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, h->fd, 0);
+        if (h->map == MAP_FAILED)
+        {
+            int err = errno;
+            close(h->fd);
+            h->fd = -1;
+            h->map = NULL;
+            errno = err;
+            return -1;
+        }
+    }
+
+    h->active = 1;
+    h->nibble = 0;
+    h->npatches = 0;
+    E.numrows = (h->size + HEX_ROW_BYTES - 1) / HEX_ROW_BYTES;
+    return 0;
+}
+
+long long editorHexOffset() // byte under the cursor
+{
+    return (long long)E.cy * HEX_ROW_BYTES + E.cx;
+}
+
+int editorHexRowLen(int row)
+{
+    long long left = E.hex.size - (long long)row * HEX_ROW_BYTES;
+    if (left <= 0)
+        return 0;
+    return left < HEX_ROW_BYTES ? left : HEX_ROW_BYTES;
+}
+
+int editorHexCxToRx(int cx, int nibble) // "0000000000  xx xx .. xx  xx .. |ascii|"
+{
+    return 12 + cx * 3 + (cx >= HEX_ROW_BYTES / 2) + nibble;
+}
+
+int editorHexRender(int row, char *buf) // renders row into buf (>= 80 bytes), returns its length
+{
+    unsigned char *p = &E.hex.map[(long long)row * HEX_ROW_BYTES];
+    int n = editorHexRowLen(row);
+    int len = sprintf(buf, "%010llx  ", (unsigned long long)row * HEX_ROW_BYTES);
+    int j;
+
+    for (j = 0; j < HEX_ROW_BYTES; j++)
+    {
+        if (j < n)
+            len += sprintf(&buf[len], "%02x ", p[j]);
+        else
+            len += sprintf(&buf[len], "   ");
+        if (j == HEX_ROW_BYTES / 2 - 1)
+            buf[len++] = ' ';
+    }
+
+    buf[len++] = '|';
+    for (j = 0; j < n; j++)
+        buf[len++] = isprint(p[j]) ? p[j] : '.';
+    buf[len++] = '|';
+    return len;
+}
+
+void editorHexPatch(long long off, unsigned char byte)
+{
+    struct editorHex *h = &E.hex;
+
+    h->map[off] = byte;
+    E.dirty++;
+
+    if (h->npatches > 0) // typing runs forward, so usually this just extends the last patch
+    {
+        struct hexPatch *last = &h->patches[h->npatches - 1];
+        if (off >= last->off && off <= last->off + last->len)
+        {
+            if (off == last->off + last->len)
+                last->len++;
+            return;
+        }
+    }
+
+    if (h->npatches == h->patchcap)
+    {
+        h->patchcap = h->patchcap ? h->patchcap * 2 : 16;
+        h->patches = realloc(h->patches, sizeof(struct hexPatch) * h->patchcap);
+    }
+    h->patches[h->npatches].off = off;
+    h->patches[h->npatches].len = 1;
+    h->npatches++;
+}
+
+int hexPatchCmp(const void *a, const void *b)
+{
+    const struct hexPatch *x = a, *y = b;
+    return (x->off > y->off) - (x->off < y->off);
+}
+
+void editorHexSave()
+{
+    struct editorHex *h = &E.hex;
+    long long written = 0;
+    int j, n = 0;
+
+    if (h->readonly)
+    {
+        editorSetStatusMessage("Can't save! %s is read-only", E.filename);
+        return;
+    }
+
+    qsort(h->patches, h->npatches, sizeof(struct hexPatch), hexPatchCmp);
+    for (j = 0; j < h->npatches; j++) // merge overlapping/adjacent patches
+    {
+        if (n > 0 && h->patches[j].off <= h->patches[n - 1].off + h->patches[n - 1].len)
+        {
+            long long end = h->patches[j].off + h->patches[j].len;
+            if (end > h->patches[n - 1].off + h->patches[n - 1].len)
+                h->patches[n - 1].len = end - h->patches[n - 1].off;
+        }
+        else
+            h->patches[n++] = h->patches[j];
+    }
+    h->npatches = n;
+
+    for (j = 0; j < h->npatches; j++)
+    {
+        struct hexPatch *pt = &h->patches[j];
+        if (editorPwriteAll(h->fd, (char *)&h->map[pt->off], pt->len, pt->off) == -1)
+            break;
+        written += pt->len;
+    }
+
+    if (j < h->npatches || fsync(h->fd) == -1)
+    {
+        editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+        return;
+    }
+
+    h->npatches = 0;
+    E.dirty = 0;
+    editorSetStatusMessage("%lld bytes patched on disk", written);
+}
+
+void editorHexMoveCursor(int key)
+{
+    switch (key)
+    {
+    case ARROW_LEFT:
+        if (E.hex.nibble)
+            E.hex.nibble = 0;
+        else if (E.cx > 0)
+            E.cx--;
+        else if (E.cy > 0)
+        {
+            E.cy--;
+            E.cx = HEX_ROW_BYTES - 1;
+        }
+        return;
+    case ARROW_RIGHT:
+        if (E.cx < editorHexRowLen(E.cy) - 1)
+            E.cx++;
+        else if (E.cy < E.numrows - 1)
+        {
+            E.cy++;
+            E.cx = 0;
+        }
+        E.hex.nibble = 0;
+        return;
+    case ARROW_UP:
+        if (E.cy > 0)
+            E.cy--;
+        break;
+    case ARROW_DOWN:
+        if (E.cy < E.numrows - 1)
+            E.cy++;
+        break;
+    case PAGE_UP:
+        E.cy = E.cy > E.screenrows ? E.cy - E.screenrows : 0;
+        break;
+    case PAGE_DOWN:
+        E.cy += E.screenrows;
+        if (E.cy > E.numrows - 1)
+            E.cy = E.numrows > 0 ? E.numrows - 1 : 0;
+        break;
+    case HOME_KEY:
+        E.cx = 0;
+        E.hex.nibble = 0;
+        break;
+    case END_KEY:
+        E.cx = HEX_ROW_BYTES - 1;
+        break;
+    }
+
+    int rowlen = editorHexRowLen(E.cy); // last row can be short
+    if (E.cx > rowlen - 1)
+        E.cx = rowlen > 0 ? rowlen - 1 : 0;
+}
+
+int editorHexProcessKey(int c) // hex view keys; 0 if c is for the generic handler (save, quit, go to, buffers)
+{
+    if (c == CTRL_KEY('s') || c == CTRL_KEY('q') || c == CTRL_KEY('g') || c == CTRL_KEY('o') || c == CTRL_KEY('n'))
+        return 0;
+
+    if (c >= 1000) // navigation keys all live above plain bytes
+    {
+        editorHexMoveCursor(c);
+        return 1;
+    }
+
+    if (isxdigit(c) && E.hex.size > 0) // overwrite the nibble under the cursor and advance
+    {
+        int v = isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+        long long off = editorHexOffset();
+        unsigned char byte = E.hex.map[off];
+
+        if (E.hex.nibble == 0)
+            byte = (byte & 0x0f) | (v << 4);
+        else
+            byte = (byte & 0xf0) | v;
+        editorHexPatch(off, byte);
+
+        if (E.hex.nibble == 0)
+            E.hex.nibble = 1;
+        else
+            editorHexMoveCursor(ARROW_RIGHT);
+    }
+    return 1; // nothing else edits a binary file
+}
+
+/***    navigation    ***/
+/*jumps cost the same on any file size. rows are grouped in blocks of NAV_BLOCK
+and a segment tree over the blocks keeps, for every span, its byte length and
+per bracket kind the net nesting change and the lowest depth reached. editing a
+row updates one leaf and its ancestors. blocks hold NAV_BLOCK/2..2*NAV_BLOCK
+rows, so inserting or deleting a row just changes its block's count, splitting
+or merging it with a neighbour when it leaves that range; the row of a block is
+found by descending on the row counts.
+a span holds the bracket matching an opener at relative depth d iff
+d + minpre < 0; scanning backwards the highest suffix depth is delta - minpre*/
+
+void navSumAppend(struct navSum *a, const struct navSum *b) // a = a followed by b
+{
+    int k;
+    for (k = 0; k < 3; k++)
+    {
+        if (a->delta[k] + b->minpre[k] < a->minpre[k])
+            a->minpre[k] = a->delta[k] + b->minpre[k];
+        a->delta[k] += b->delta[k];
+    }
+}
+
+void editorNavBuildLeaf(int b, int start) // recompute block b, which holds rows start..start+rows-1
+{
+    struct navNode *n = &E.nav.tree[E.nav.leaves + b];
+    int j, end = start + n->rows;
+
+    n->bytes = 0;
+    memset(&n->br, 0, sizeof(n->br));
+    for (j = start; j < end; j++)
+    {
+        n->bytes += E.row[j].size + 1;
+        navSumAppend(&n->br, &E.row[j].br);
+    }
+}
+
+void editorNavPull(int i) // recompute node i from its children
+{
+    E.nav.tree[i] = E.nav.tree[2 * i];
+    E.nav.tree[i].bytes += E.nav.tree[2 * i + 1].bytes;
+    E.nav.tree[i].rows += E.nav.tree[2 * i + 1].rows;
+    navSumAppend(&E.nav.tree[i].br, &E.nav.tree[2 * i + 1].br);
+}
+
+void editorNavBuild()
+{
+    int blocks = (E.numrows + NAV_BLOCK - 1) / NAV_BLOCK;
+    int b, leaves = 1;
+
+    if (blocks == 0)
+        blocks = 1; // an empty document still has one (empty) block to insert into
+    while (leaves < 2 * blocks) // room for the blocks to split into before the next rebuild
+        leaves *= 2;
+
+    free(E.nav.tree);
+    E.nav.tree = calloc(2 * leaves, sizeof(struct navNode));
+    if (E.nav.tree == NULL)
+        die("calloc");
+    E.nav.leaves = leaves;
+    E.nav.blocks = blocks;
+
+    for (b = 0; b < blocks; b++)
+    {
+        E.nav.tree[leaves + b].rows = b < blocks - 1 ? NAV_BLOCK : E.numrows - b * NAV_BLOCK;
+        editorNavBuildLeaf(b, b * NAV_BLOCK);
+    }
+    for (b = leaves - 1; b >= 1; b--)
+        editorNavPull(b);
+    E.nav.valid = 1;
+}
+
+void editorNavEnsure()
+{
+    if (!E.nav.valid)
+        editorNavBuild();
+}
+
+int editorNavBlock(int at, int *start) // block holding row at, and its first row
+{
+    int i = 1, base = 0;
+
+    while (i < E.nav.leaves) // descend by row count, past the end lands in the last block
+    {
+        if (at < base + E.nav.tree[2 * i].rows || E.nav.tree[2 * i + 1].rows == 0)
+            i = 2 * i;
+        else
+        {
+            base += E.nav.tree[2 * i].rows;
+            i = 2 * i + 1;
+        }
+    }
+    *start = base;
+    return i - E.nav.leaves;
+}
+
+int editorNavBlockStart(int b) // first row of block b
+{
+    int i, start = 0;
+
+    for (i = E.nav.leaves + b; i > 1; i /= 2) // add every left sibling on the way up
+        if (i & 1)
+            start += E.nav.tree[i - 1].rows;
+    return start;
+}
+
+void editorNavUpdateRow(int at)
+{
+    int start, i = E.nav.leaves + editorNavBlock(at, &start);
+
+    editorNavBuildLeaf(i - E.nav.leaves, start);
+    for (i /= 2; i >= 1; i /= 2)
+        editorNavPull(i);
+}
+
+void editorNavReshape(int b, int start) // block b changed size: split it, merge it, or just refresh it
+{
+    struct navNode *leaf = E.nav.tree + E.nav.leaves;
+    int i;
+
+    if (leaf[b].rows > 2 * NAV_BLOCK)
+    {
+        if (E.nav.blocks == E.nav.leaves) // no spare leaf, re-block everything (amortised over the inserts that filled it)
+        {
+            editorNavBuild();
+            return;
+        }
+        memmove(&leaf[b + 2], &leaf[b + 1], sizeof(struct navNode) * (E.nav.blocks - b - 1));
+        E.nav.blocks++;
+        leaf[b + 1].rows = leaf[b].rows - NAV_BLOCK;
+        leaf[b].rows = NAV_BLOCK;
+        editorNavBuildLeaf(b, start);
+        editorNavBuildLeaf(b + 1, start + NAV_BLOCK);
+    }
+    else if (leaf[b].rows < NAV_BLOCK / 2 && E.nav.blocks > 1)
+    {
+        if (b == E.nav.blocks - 1) // the last block merges into the one before it
+        {
+            b--;
+            start -= leaf[b].rows;
+        }
+        leaf[b].rows += leaf[b + 1].rows;
+        memmove(&leaf[b + 1], &leaf[b + 2], sizeof(struct navNode) * (E.nav.blocks - b - 2));
+        E.nav.blocks--;
+        memset(&leaf[E.nav.blocks], 0, sizeof(struct navNode));
+        if (leaf[b].rows > 2 * NAV_BLOCK)
+        {
+            editorNavReshape(b, start);
+            return;
+        }
+        editorNavBuildLeaf(b, start);
+    }
+    else
+    {
+        editorNavBuildLeaf(b, start);
+        for (i = (E.nav.leaves + b) / 2; i >= 1; i /= 2)
+            editorNavPull(i);
+        return;
+    }
+
+    for (i = E.nav.leaves - 1; i >= 1; i--) // blocks shifted, every inner node may have changed
+        editorNavPull(i);
+}
+
+void editorNavRowInserted(int at) // row at is new, rows below moved down by one
+{
+    int start, b = editorNavBlock(at > 0 ? at - 1 : 0, &start); // joins the block of the row above it
+
+    E.nav.tree[E.nav.leaves + b].rows++;
+    editorNavReshape(b, start);
+}
+
+void editorNavRowDeleted(int at) // row at is gone, rows below moved up by one
+{
+    int start, b = editorNavBlock(at, &start);
+
+    E.nav.tree[E.nav.leaves + b].rows--;
+    editorNavReshape(b, start);
+}
+
+int editorNavRowAtOffset(long long off, long long *rowstart) // row containing byte off, and where that row starts
+{
+    int i = 1;
+    long long base = 0;
+    int j = 0, end;
+
+    editorNavEnsure();
+    if (off >= E.nav.tree[1].bytes)
+    {
+        *rowstart = E.nav.tree[1].bytes;
+        return E.numrows;
+    }
+
+    while (i < E.nav.leaves) // descend by byte count
+    {
+        if (off < base + E.nav.tree[2 * i].bytes)
+            i = 2 * i;
+        else
+        {
+            base += E.nav.tree[2 * i].bytes;
+            j += E.nav.tree[2 * i].rows;
+            i = 2 * i + 1;
+        }
+    }
+
+    end = j + E.nav.tree[i].rows;
+    for (; j < end - 1 && base + E.row[j].size + 1 <= off; j++)
+        base += E.row[j].size + 1;
+    *rowstart = base;
+    return j;
+}
+
+long long editorNavRowOffset(int at) // byte offset of the start of row at
+{
+    int i = 1, j = 0;
+    long long off = 0;
+
+    editorNavEnsure();
+    if (at >= E.numrows)
+        return E.nav.tree[1].bytes;
+
+    while (i < E.nav.leaves) // descend by row count, adding the bytes of every left subtree passed
+    {
+        if (at < j + E.nav.tree[2 * i].rows)
+            i = 2 * i;
+        else
+        {
+            j += E.nav.tree[2 * i].rows;
+            off += E.nav.tree[2 * i].bytes;
+            i = 2 * i + 1;
+        }
+    }
+    for (; j < at; j++)
+        off += E.row[j].size + 1;
+    return off;
+}
+
+// first block >= from (in node i covering blocks [lo, hi)) where depth *d dips below 0, -1 if none
+int navSearchForward(int i, int lo, int hi, int from, int k, int *d)
+{
+    if (hi <= from)
+        return -1;
+    if (lo >= from && *d + E.nav.tree[i].br.minpre[k] >= 0) // whole node is skipped
+    {
+        *d += E.nav.tree[i].br.delta[k];
+        return -1;
+    }
+    if (hi - lo == 1)
+        return lo;
+
+    int mid = (lo + hi) / 2;
+    int b = navSearchForward(2 * i, lo, mid, from, k, d);
+    return b != -1 ? b : navSearchForward(2 * i + 1, mid, hi, from, k, d);
+}
+
+// last block < to where reverse depth *d dips below 0 walking backwards, -1 if none
+int navSearchBackward(int i, int lo, int hi, int to, int k, int *d)
+{
+    if (lo >= to)
+        return -1;
+    int maxsuf = E.nav.tree[i].br.delta[k] - E.nav.tree[i].br.minpre[k];
+    if (hi <= to && *d - maxsuf >= 0)
+    {
+        *d -= E.nav.tree[i].br.delta[k];
+        return -1;
+    }
+    if (hi - lo == 1)
+        return lo;
+
+    int mid = (lo + hi) / 2;
+    int b = navSearchBackward(2 * i + 1, mid, hi, to, k, d);
+    return b != -1 ? b : navSearchBackward(2 * i, lo, mid, to, k, d);
+}
+
+int editorMatchBracket() // move the cursor to the bracket matching the one under (or just before) it
+{
+    if (E.cy >= E.numrows || E.hex.active)
+        return -1;
+
+    erow *row = &E.row[E.cy];
+    int cx = E.cx;
+    if (cx >= row->size || bracketKind(row->chars[cx]) == -1)
+        cx--;
+    if (cx < 0 || bracketKind(row->chars[cx]) == -1)
+        return -1;
+
+    int k = bracketKind(row->chars[cx]);
+    int dir = strchr("([{", row->chars[cx]) ? 1 : -1;
+    int d = 0, y = E.cy, x = cx, j;
+
+    editorNavEnsure();
+
+    while (1)
+    {
+        row = &E.row[y];
+        for (x += dir; x >= 0 && x < row->size; x += dir) // finish the current row char by char
+        {
+            if (bracketKind(row->chars[x]) != k)
+                continue;
+            d += (strchr("([{", row->chars[x]) ? 1 : -1) * dir;
+            if (d < 0)
+            {
+                E.cy = y;
+                E.cx = x;
+                return 0;
+            }
+        }
+
+        // find the next row that can hold the match: rest of this block row by row, then the tree
+        int lo, b = editorNavBlock(y, &lo);
+        int hi = lo + E.nav.tree[E.nav.leaves + b].rows;
+        int found = -1;
+
+        for (j = y + dir; j >= lo && j < hi; j += dir)
+        {
+            struct navSum *br = &E.row[j].br;
+            if (dir > 0 ? d + br->minpre[k] < 0 : d - (br->delta[k] - br->minpre[k]) < 0)
+            {
+                found = j;
+                break;
+            }
+            d += dir * br->delta[k];
+        }
+
+        if (found == -1)
+        {
+            b = dir > 0 ? navSearchForward(1, 0, E.nav.leaves, b + 1, k, &d)
+                        : navSearchBackward(1, 0, E.nav.leaves, b, k, &d);
+            if (b == -1 || b >= E.nav.blocks)
+                return -1;
+            lo = editorNavBlockStart(b);
+            hi = lo + E.nav.tree[E.nav.leaves + b].rows;
+            for (j = dir > 0 ? lo : hi - 1; j >= lo && j < hi; j += dir)
+            {
+                struct navSum *br = &E.row[j].br;
+                if (dir > 0 ? d + br->minpre[k] < 0 : d - (br->delta[k] - br->minpre[k]) < 0)
+                {
+                    found = j;
+                    break;
+                }
+                d += dir * br->delta[k];
+            }
+            if (found == -1)
+                return -1;
+        }
+
+        y = found;
+        x = dir > 0 ? -1 : E.row[y].size;
+    }
+}
+
+void editorGotoRow(int at) // jump straight to a row, clamping the cursor like editorMoveCursor does
+{
+    if (at > E.numrows)
+        at = E.numrows;
+    if (at < 0)
+        at = 0;
+    E.cy = at;
+
+    int rowlen = E.hex.active ? editorHexRowLen(at) : (at < E.numrows ? E.row[at].size : 0);
+    if (E.cx > rowlen)
+        E.cx = rowlen;
+}
+
+void editorGotoOffset(long long off)
+{
+    if (off < 0)
+        off = 0;
+
+    if (E.hex.active)
+    {
+        if (off >= E.hex.size)
+            off = E.hex.size > 0 ? E.hex.size - 1 : 0;
+        E.cy = off / HEX_ROW_BYTES;
+        E.cx = off % HEX_ROW_BYTES;
+        E.hex.nibble = 0;
+        return;
+    }
+
+    long long start;
+    E.cy = editorNavRowAtOffset(off, &start);
+    E.cx = E.cy < E.numrows && off - start <= E.row[E.cy].size ? off - start : 0;
+}
+
+void editorGoto() // Ctl+G: "120" line, "@4096" / "@0x1000" byte offset, "50%" of the file
+{
+    char *query = editorPrompt("Go to (line, @offset, N%%): %s (ESC to cancel)");
+    if (query == NULL)
+        return;
+
+    char *end;
+    long long total = E.hex.active ? E.hex.size : E.stats.bytes + E.numrows;
+
+    if (query[0] == '@')
+        editorGotoOffset(strtoll(&query[1], &end, 0));
+    else
+    {
+        double v = strtod(query, &end);
+        double most = *end == '%' ? 100.0 : E.hex.active ? E.hex.size / HEX_ROW_BYTES + 1 : E.numrows + 1;
+        if (!(v > 0)) // clamp before converting, casting an out of range double is undefined (also catches nan)
+            v = 0;
+        if (v > most)
+            v = most;
+        if (*end == '%')
+            editorGotoOffset((long long)(v / 100.0 * total));
+        else if (E.hex.active)
+            editorGotoOffset(((long long)v - 1) * HEX_ROW_BYTES);
+        else
+            editorGotoRow((int)v - 1);
+    }
+
+    int vy = editorFoldBufToVis(E.cy);
+    if (vy < E.screenrows / 2 || vy < E.rowoff || vy >= E.rowoff + E.screenrows) // center the target
+        E.rowoff = vy > E.screenrows / 2 ? vy - E.screenrows / 2 : 0;
+    free(query);
+}
+
+/***    folding    ***/
+/*folds are kept in a treap ordered by start row. each node knows how many rows
+its subtree hides, so mapping a visible (screen) row to a buffer row and back is
+one walk down the tree, O(log n), however much is folded. inserting or deleting
+a row shifts every fold after it; that is a split plus a lazy shift tag on the
+right half instead of touching each fold*/
+
+int foldHidden(foldNode *n)
+{
+    return n ? n->hidden : 0;
+}
+
+void foldApplyShift(foldNode *n, int v)
+{
+    if (!n)
+        return;
+    n->start += v;
+    n->end += v;
+    n->shift += v;
+}
+
+void foldPush(foldNode *n) // hand a pending shift down to the children
+{
+    if (n->shift)
+    {
+        foldApplyShift(n->left, n->shift);
+        foldApplyShift(n->right, n->shift);
+        n->shift = 0;
+    }
+}
+
+void foldPull(foldNode *n)
+{
+    n->hidden = (n->end - n->start) + foldHidden(n->left) + foldHidden(n->right);
+}
+
+void foldSplit(foldNode *t, int key, foldNode **l, foldNode **r) // l: start < key, r: start >= key
+{
+    if (!t)
+    {
+        *l = *r = NULL;
+        return;
+    }
+    foldPush(t);
+    if (t->start < key)
+    {
+        foldSplit(t->right, key, &t->right, r);
+        *l = t;
+    }
+    else
+    {
+        foldSplit(t->left, key, l, &t->left);
+        *r = t;
+    }
+    foldPull(t);
+}
+
+foldNode *foldMerge(foldNode *l, foldNode *r) // every start in l < every start in r
+{
+    if (!l || !r)
+        return l ? l : r;
+    if (l->prio > r->prio)
+    {
+        foldPush(l);
+        l->right = foldMerge(l->right, r);
+        foldPull(l);
+        return l;
+    }
+    foldPush(r);
+    r->left = foldMerge(l, r->left);
+    foldPull(r);
+    return r;
+}
+
+void foldFreeTree(foldNode *t)
+{
+    if (!t)
+        return;
+    foldFreeTree(t->left);
+    foldFreeTree(t->right);
+    free(t);
+}
+
+foldNode *foldPopMax(foldNode **t) // detach the fold with the greatest start
+{
+    foldNode *n = *t, *max;
+    if (!n)
+        return NULL;
+    foldPush(n);
+    if (!n->right)
+    {
+        *t = n->left;
+        n->left = NULL;
+        foldPull(n);
+        return n;
+    }
+    max = foldPopMax(&n->right);
+    foldPull(n);
+    return max;
+}
+
+int editorFoldVisToBuf(int v) // screen row -> buffer row
+{
+    foldNode *n = E.folds;
+    int h = 0; // rows hidden before the answer
+
+    while (n)
+    {
+        foldPush(n);
+        int hl = foldHidden(n->left);
+        if (v <= n->start - (h + hl))
+            n = n->left;
+        else
+        {
+            h += hl + (n->end - n->start);
+            n = n->right;
+        }
+    }
+    return v + h;
+}
+
+int editorFoldBufToVis(int b) // buffer row -> screen row; a hidden row maps to its fold's header
+{
+    foldNode *n = E.folds;
+    int h = 0;
+
+    while (n)
+    {
+        foldPush(n);
+        int hl = foldHidden(n->left);
+        if (b <= n->start)
+            n = n->left;
+        else if (b <= n->end)
+            return n->start - (h + hl);
+        else
+        {
+            h += hl + (n->end - n->start);
+            n = n->right;
+        }
+    }
+    return b - h;
+}
+
+foldNode *editorFoldFind(int at) // fold whose header or hidden rows include at
+{
+    foldNode *n = E.folds;
+    while (n)
+    {
+        foldPush(n);
+        if (at < n->start)
+            n = n->left;
+        else if (at > n->end)
+            n = n->right;
+        else
+            return n;
+    }
+    return NULL;
+}
+
+void editorFoldRemove(int start)
+{
+    foldNode *l, *m, *r;
+    foldSplit(E.folds, start, &l, &r);
+    foldSplit(r, start + 1, &m, &r);
+    foldFreeTree(m);
+    E.folds = foldMerge(l, r);
+}
+
+void editorFoldAdd(int start, int end) // hide start+1..end, swallowing folds that start inside
+{
+    foldNode *l, *m, *r, *last;
+
+    foldSplit(E.folds, start, &l, &r);
+    foldSplit(r, end + 1, &m, &r);
+    last = foldPopMax(&m);
+    if (last && last->end > end)
+        end = last->end;
+    free(last);
+    foldFreeTree(m);
+
+    foldNode *n = calloc(1, sizeof(foldNode));
+    n->start = start;
+    n->end = end;
+    n->prio = rand();
+    foldPull(n);
+    E.folds = foldMerge(foldMerge(l, n), r);
+}
+
+void editorFoldRowInserted(int at) // rows at.. moved down one
+{
+    foldNode *l, *r, *last;
+
+    if (!E.folds)
+        return;
+    foldSplit(E.folds, at, &l, &r);
+    foldApplyShift(r, 1);
+    last = foldPopMax(&l);
+    if (last)
+    {
+        if (last->end >= at) // new row landed inside this fold's hidden range
+            last->end++;
+        foldPull(last);
+        l = foldMerge(l, last);
+    }
+    E.folds = foldMerge(l, r);
+}
+
+void editorFoldRowDeleted(int at) // row at is gone, rows after it moved up one
+{
+    foldNode *l, *m, *r, *last;
+
+    if (!E.folds)
+        return;
+    foldSplit(E.folds, at, &l, &r);
+    foldSplit(r, at + 1, &m, &r);
+    foldFreeTree(m); // its header row went away, the rows it hid show again
+    foldApplyShift(r, -1);
+    last = foldPopMax(&l);
+    if (last)
+    {
+        if (last->end >= at)
+            last->end--;
+        foldPull(last);
+        if (last->end > last->start)
+            l = foldMerge(l, last);
+        else
+            free(last);
+    }
+    E.folds = foldMerge(l, r);
+}
+
+void editorFoldReveal(int at) // the cursor ended up on a hidden row (goto, search...), open its fold
+{
+    foldNode *f;
+    while ((f = editorFoldFind(at)) && f->start != at)
+        editorFoldRemove(f->start);
+}
+
+int editorFoldNextRow(int b, int dir) // next visible row up (dir -1) or down (+1)
+{
+    return editorFoldVisToBuf(editorFoldBufToVis(b) + dir);
+}
+
+int editorFoldRange(int at) // last row that folding at should hide, or at if there is nothing to fold
+{
+    erow *row = &E.row[at];
+    int j, k, depth[3] = {0, 0, 0}, opener = -1;
+
+    /*the last opener left unclosed on this row folds to the row before its match*/
+    for (j = row->size - 1; j >= 0 && opener == -1; j--)
+    {
+        k = bracketKind(row->chars[j]);
+        if (k == -1)
+            continue;
+        if (strchr("([{", row->chars[j]))
+        {
+            if (depth[k] == 0)
+                opener = j;
+            else
+                depth[k]--;
+        }
+        else
+            depth[k]++;
+    }
+
+    if (opener != -1)
+    {
+        int cy = E.cy, cx = E.cx, end = at;
+        E.cy = at;
+        E.cx = opener;
+        if (editorMatchBracket() == 0 && E.cy > at)
+            end = E.cy - 1 > at ? E.cy - 1 : E.cy;
+        E.cy = cy;
+        E.cx = cx;
+        if (end > at)
+            return end;
+    }
+
+    /*otherwise fold the rows below that are indented deeper (blank rows included)*/
+    int indent = 0, end = at;
+    char *render = editorRowRender(row);
+    while (indent < row->rsize && render[indent] == ' ')
+        indent++;
+    for (j = at + 1; j < E.numrows; j++)
+    {
+        erow *r = &E.row[j];
+        int ind = 0;
+        render = editorRowRender(r);
+        while (ind < r->rsize && render[ind] == ' ')
+            ind++;
+        if (ind == r->rsize) // blank
+            continue;
+        if (ind <= indent)
+            break;
+        end = j;
+    }
+    return end;
+}
+
+void editorToggleFold() // Ctl+K
+{
+    if (E.cy >= E.numrows)
+        return;
+
+    foldNode *f = editorFoldFind(E.cy);
+    if (f && f->start == E.cy)
+    {
+        editorFoldRemove(E.cy);
+        return;
+    }
+
+    int end = editorFoldRange(E.cy);
+    if (end == E.cy)
+    {
+        editorSetStatusMessage("Nothing to fold here");
+        return;
+    }
+    editorFoldAdd(E.cy, end);
+    editorSetStatusMessage("Folded %d lines", end - E.cy);
+}
+
+/***    multiple cursors    ***/
+/*extra cursors live in E.cursors next to the primary cx/cy. an edit is applied
+to all of them as one batch: cursors are grouped by row, every affected row gets
+its new chars built in a single pass and is re-rendered once, and the cursor
+positions are fixed up in the same pass. the screen is repainted once per key
+as usual. edits that would add or join rows (enter, backspace at column 0, DEL
+at the end of a row) only ever apply to the primary cursor; the extras shift
+along with the rows*/
+
+int cursorCmp(const void *a, const void *b)
+{
+    const struct editorCursor *x = a, *y = b;
+    if (x->cy != y->cy)
+        return x->cy < y->cy ? -1 : 1;
+    return (x->cx > y->cx) - (x->cx < y->cx);
+}
+
+void editorCursorsNormalize() // sort, drop duplicates and anything sitting on the primary cursor
+{
+    int j, n = 0;
+
+    qsort(E.cursors, E.ncursors, sizeof(struct editorCursor), cursorCmp);
+    for (j = 0; j < E.ncursors; j++)
+    {
+        struct editorCursor *c = &E.cursors[j];
+        if (c->cy == E.cy && c->cx == E.cx)
+            continue;
+        if (n > 0 && cursorCmp(c, &E.cursors[n - 1]) == 0)
+            continue;
+        E.cursors[n++] = *c;
+    }
+    E.ncursors = n;
+}
+
+void editorCursorAdd(int cx, int cy)
+{
+    if (E.ncursors == E.cursorcap)
+    {
+        E.cursorcap = E.cursorcap ? E.cursorcap * 2 : 16;
+        E.cursors = realloc(E.cursors, sizeof(struct editorCursor) * E.cursorcap);
+        if (E.cursors == NULL)
+            die("realloc");
+    }
+    E.cursors[E.ncursors].cx = cx;
+    E.cursors[E.ncursors].cy = cy;
+    E.ncursors++;
+    if (E.folds)
+        editorFoldReveal(cy);
+    editorCursorsNormalize();
+}
+
+void editorCursorsClear()
+{
+    E.ncursors = 0;
+}
+
+int editorCursorsFirstOnRow(int row) // index of the first extra cursor on row (binary search)
+{
+    int lo = 0, hi = E.ncursors;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (E.cursors[mid].cy < row)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*all cursors, primary included, in document order. *primary gets the index of
+the primary one so it can be written back after the batch*/
+struct editorCursor *editorCursorsAll(int *n, int *primary)
+{
+    struct editorCursor *all = malloc(sizeof(struct editorCursor) * (E.ncursors + 1));
+    int j = editorCursorsFirstOnRow(E.cy);
+
+    while (j < E.ncursors && E.cursors[j].cy == E.cy && E.cursors[j].cx < E.cx)
+        j++;
+    memcpy(all, E.cursors, sizeof(struct editorCursor) * j);
+    all[j].cx = E.cx;
+    all[j].cy = E.cy;
+    memcpy(&all[j + 1], &E.cursors[j], sizeof(struct editorCursor) * (E.ncursors - j));
+    *n = E.ncursors + 1;
+    *primary = j;
+    return all;
+}
+
+void editorCursorsStore(struct editorCursor *all, int n, int primary)
+{
+    E.cx = all[primary].cx;
+    E.cy = all[primary].cy;
+    memmove(&all[primary], &all[primary + 1], sizeof(struct editorCursor) * (n - primary - 1));
+    memcpy(E.cursors, all, sizeof(struct editorCursor) * (n - 1));
+    E.ncursors = n - 1;
+    free(all);
+    editorCursorsNormalize();
+}
+
+void editorRowReplaceChars(erow *row, char *chars, int size)
+{
+    free(row->chars);
+    row->chars = chars;
+    row->size = size;
+    row->chars[size] = '\0';
+    editorUpdateRow(row);
+}
+
+void editorMultiInsertChar(int c)
+{
+    int n, primary, i, j;
+    struct editorCursor *all = editorCursorsAll(&n, &primary);
+
+    if (all[n - 1].cy == E.numrows) // a cursor on the ~ line after EOF
+        editorInsertRow(E.numrows, "", 0);
+
+    for (i = 0; i < n; i = j) // one row at a time
+    {
+        erow *row = &E.row[all[i].cy];
+        for (j = i; j < n && all[j].cy == all[i].cy; j++)
+            ;
+
+        char *chars = malloc(row->size + (j - i) + 1);
+        int src = 0, dst = 0, k;
+        for (k = i; k < j; k++)
+        {
+            int at = all[k].cx > row->size ? row->size : all[k].cx;
+            memcpy(&chars[dst], &row->chars[src], at - src);
+            dst += at - src;
+            src = at;
+            chars[dst++] = c;
+            all[k].cx = dst; // just after the inserted char
+        }
+        memcpy(&chars[dst], &row->chars[src], row->size - src);
+        editorRowReplaceChars(row, chars, dst + row->size - src);
+    }
+
+    E.dirty++;
+    editorCursorsStore(all, n, primary);
+}
+
+void editorMultiDelChar(int forward) // backspace (or DEL when forward) at every cursor
+{
+    int n, primary, i, j;
+    struct editorCursor *all = editorCursorsAll(&n, &primary);
+    int join = -1; // the primary joins row join + 1 onto row join
+
+    if (all[primary].cy < E.numrows)
+    {
+        if (!forward && all[primary].cx == 0 && all[primary].cy > 0)
+            join = all[primary].cy - 1;
+        if (forward && all[primary].cx >= E.row[all[primary].cy].size && all[primary].cy + 1 < E.numrows)
+            join = all[primary].cy;
+    }
+
+    for (i = 0; i < n; i = j)
+    {
+        for (j = i; j < n && all[j].cy == all[i].cy; j++)
+            ;
+        if (all[i].cy >= E.numrows)
+            continue;
+
+        erow *row = &E.row[all[i].cy];
+        char *chars = malloc(row->size + 1);
+        int src = 0, dst = 0, k;
+        for (k = i; k < j; k++)
+        {
+            int del = forward ? all[k].cx : all[k].cx - 1; // char to remove
+            if (del < src || del >= row->size) // col 0 / end of row, or already removed by the previous cursor
+            {
+                all[k].cx = dst + (all[k].cx - src > 0 ? all[k].cx - src : 0);
+                continue;
+            }
+            memcpy(&chars[dst], &row->chars[src], del - src);
+            dst += del - src;
+            src = del + 1;
+            all[k].cx = dst;
+        }
+        memcpy(&chars[dst], &row->chars[src], row->size - src);
+        editorRowReplaceChars(row, chars, dst + row->size - src);
+    }
+
+    if (join != -1)
+    {
+        int len = E.row[join].size;
+        for (i = 0; i < n; i++) // cursors on the joined row move to its new place, the rest move up a row
+        {
+            if (all[i].cy == join + 1)
+            {
+                all[i].cy = join;
+                all[i].cx += len;
+            }
+            else if (all[i].cy > join + 1)
+                all[i].cy--;
+        }
+        editorRowAppendString(&E.row[join], E.row[join + 1].chars, E.row[join + 1].size);
+        editorDelRow(join + 1);
+    }
+
+    E.dirty++;
+    editorCursorsStore(all, n, primary);
+}
+
+void editorMultiMove(int key) // move every cursor like the primary
+{
+    int n, primary, k;
+    struct editorCursor *all = editorCursorsAll(&n, &primary);
+
+    for (k = 0; k < n; k++)
+    {
+        E.cx = all[k].cx;
+        E.cy = all[k].cy;
+        editorMoveCursor(key);
+        if (k != primary && E.cy >= E.numrows && E.numrows > 0) // only the primary may sit on the ~ line after EOF
+        {
+            E.cy = E.numrows - 1;
+            if (E.cx > E.row[E.cy].size)
+                E.cx = E.row[E.cy].size;
+        }
+        all[k].cx = E.cx;
+        all[k].cy = E.cy;
+    }
+    editorCursorsStore(all, n, primary);
+}
+
+int isWordChar(int c)
+{
+    return isalnum(c) || c == '_';
+}
+
+void editorCursorAddNextMatch() // Ctl+D: another cursor on the next occurrence of the word under the cursor
+{
+    if (E.cy >= E.numrows)
+        return;
+
+    erow *row = &E.row[E.cy];
+    int ws = E.cx, we = E.cx;
+    if (ws > 0 && (ws == row->size || !isWordChar((unsigned char)row->chars[ws])))
+        ws--, we--;
+    if (ws < 0 || ws >= row->size || !isWordChar((unsigned char)row->chars[ws]))
+    {
+        editorSetStatusMessage("No word under the cursor");
+        return;
+    }
+    while (ws > 0 && isWordChar((unsigned char)row->chars[ws - 1]))
+        ws--;
+    while (we < row->size && isWordChar((unsigned char)row->chars[we]))
+        we++;
+
+    char *word = strndup(&row->chars[ws], we - ws);
+    int wlen = we - ws, off = E.cx - ws;
+
+    /*search after the last cursor (in document order), wrapping around*/
+    struct editorCursor last = {E.cx, E.cy};
+    if (E.ncursors > 0 && cursorCmp(&E.cursors[E.ncursors - 1], &last) > 0)
+        last = E.cursors[E.ncursors - 1];
+    if (last.cy >= E.numrows) // past the last row, start over from the top
+        last.cy = last.cx = 0;
+    int y = last.cy, from = last.cx - off + wlen, scanned;
+
+    for (scanned = 0; scanned <= E.numrows; scanned++, y = (y + 1) % E.numrows, from = 0)
+    {
+        erow *r = &E.row[y];
+        char *p = r->chars + (from < r->size ? from : r->size);
+        while ((p = strstr(p, word)) != NULL)
+        {
+            int at = p - r->chars;
+            if ((at == 0 || !isWordChar((unsigned char)r->chars[at - 1])) &&
+                (at + wlen == r->size || !isWordChar((unsigned char)r->chars[at + wlen])))
+            {
+                int before = E.ncursors;
+                editorCursorAdd(at + off, y);
+                free(word);
+                if (E.ncursors == before) // wrapped around onto an existing cursor
+                    editorSetStatusMessage("No more matches");
+                else
+                    editorSetStatusMessage("%d cursors", E.ncursors + 1);
+                return;
+            }
+            p += wlen;
+        }
+    }
+    free(word);
+}
+
+void editorCursorAddColumn(int dir) // Shift+Up/Down: extend a column of cursors at the primary's column
+{
+    int edge = E.cy;
+    if (E.ncursors > 0)
+    {
+        int first = E.cursors[0].cy, last = E.cursors[E.ncursors - 1].cy;
+        if (dir > 0 && last > edge)
+            edge = last;
+        if (dir < 0 && first < edge)
+            edge = first;
+    }
+
+    int y = editorFoldNextRow(edge, dir);
+    if (y < 0 || y >= E.numrows || y == edge)
+        return;
+    editorCursorAdd(E.cx < E.row[y].size ? E.cx : E.row[y].size, y);
+    editorSetStatusMessage("%d cursors", E.ncursors + 1);
+}
+
+/***    columns    ***/
+/*delimited data (csv/tsv) shown as aligned columns. every row keeps the offsets
+where its fields start; the scan looks at 16 bytes at a time for the delimiter
+and quotes, and a whole file is indexed by several threads, each taking its own
+run of rows. quotes are only tracked within a row, a quoted field holding a
+newline shows up as two rows. column widths come from a sample of rows so that
+opening a huge file doesn't mean measuring all of it*/
+
+int csvCountDelims(const char *s, int len, char delim) // upper bound on the fields in s, less one
+{
+    int n = 0, i = 0;
+#ifdef __SSE2__
+    __m128i vd = _mm_set1_epi8(delim);
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, vd)));
+    }
+#endif
+    for (; i < len; i++)
+        if (s[i] == delim)
+            n++;
+    return n;
+}
+
+int csvSplit(const char *s, int len, char delim, int *fields) // field starts into fields, returns how many
+{
+    int n = 0, inquote = 0, i = 0;
+
+    fields[n++] = 0;
+#ifdef __SSE2__
+    __m128i vd = _mm_set1_epi8(delim), vq = _mm_set1_epi8('"');
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        unsigned int m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, vd), _mm_cmpeq_epi8(v, vq)));
+        while (m) // only the interesting bytes, lowest first
+        {
+            int at = i + __builtin_ctz(m);
+            if (s[at] == '"')
+                inquote = !inquote;
+            else if (!inquote)
+                fields[n++] = at + 1;
+            m &= m - 1;
+        }
+    }
+#endif
+    for (; i < len; i++)
+    {
+        if (s[i] == '"')
+            inquote = !inquote;
+        else if (s[i] == delim && !inquote)
+            fields[n++] = i + 1;
+    }
+    return n;
+}
+
+void editorCsvIndexRow(erow *row) // may run on a worker thread, touches nothing but row
+{
+    int *fields = realloc(row->fields, sizeof(int) * (csvCountDelims(row->chars, row->size, E.csv.delim) + 1));
+    if (fields == NULL)
+        die("realloc");
+    row->fields = fields;
+    row->nfields = csvSplit(row->chars, row->size, E.csv.delim, fields);
+}
+
+struct csvJob
+{
+    int from, to;
+};
+
+void *csvWorker(void *arg)
+{
+    struct csvJob *job = arg;
+    int j;
+    for (j = job->from; j < job->to; j++)
+        editorCsvIndexRow(&E.row[j]);
+    return NULL;
+}
+
+void editorCsvIndexAll()
+{
+    pthread_t tid[CSV_MAX_THREADS];
+    struct csvJob jobs[CSV_MAX_THREADS];
+    int started[CSV_MAX_THREADS];
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = E.numrows / CSV_THREAD_ROWS;
+    int t;
+
+    if (nthreads > ncpu)
+        nthreads = ncpu;
+    if (nthreads > CSV_MAX_THREADS)
+        nthreads = CSV_MAX_THREADS;
+    if (nthreads < 1)
+        nthreads = 1;
+
+    for (t = 0; t < nthreads; t++)
+    {
+        jobs[t].from = (long long)E.numrows * t / nthreads;
+        jobs[t].to = (long long)E.numrows * (t + 1) / nthreads;
+        started[t] = t > 0 && pthread_create(&tid[t], NULL, csvWorker, &jobs[t]) == 0;
+    }
+    for (t = 0; t < nthreads; t++) // the first job, and any that couldn't get a thread, run here
+        if (!started[t])
+            csvWorker(&jobs[t]);
+    for (t = 1; t < nthreads; t++)
+        if (started[t])
+            pthread_join(tid[t], NULL);
+}
+
+void editorCsvMeasure() // column widths from the head of the file and rows spread evenly over the rest
+{
+    int step = E.numrows > CSV_SAMPLE ? E.numrows / CSV_SAMPLE : 1;
+    int j, k;
+
+    E.csv.ncols = 0;
+    for (j = 0; j < E.numrows; j = j < CSV_SAMPLE / 10 ? j + 1 : j + step)
+        if (E.row[j].nfields > E.csv.ncols)
+            E.csv.ncols = E.row[j].nfields;
+
+    free(E.csv.widths);
+    free(E.csv.colstart);
+    E.csv.widths = calloc(E.csv.ncols + 1, sizeof(int));
+    E.csv.colstart = malloc(sizeof(int) * (E.csv.ncols + 1));
+    if (E.csv.widths == NULL || E.csv.colstart == NULL)
+        die("malloc");
+
+    for (j = 0; j < E.numrows; j = j < CSV_SAMPLE / 10 ? j + 1 : j + step)
+    {
+        erow *row = &E.row[j];
+        for (k = 0; k < row->nfields; k++)
+        {
+            int end = k + 1 < row->nfields ? row->fields[k + 1] - 1 : row->size;
+            int w = end - row->fields[k];
+            if (w > E.csv.widths[k])
+                E.csv.widths[k] = w < CSV_MAX_WIDTH ? w : CSV_MAX_WIDTH;
+        }
+    }
+
+    E.csv.colstart[0] = 0;
+    for (k = 0; k < E.csv.ncols; k++)
+    {
+        if (E.csv.widths[k] == 0)
+            E.csv.widths[k] = 1; // room for the cursor
+        E.csv.colstart[k + 1] = E.csv.colstart[k] + E.csv.widths[k] + CSV_SEP_LEN;
+    }
+}
+
+int editorCsvWidth(int k) // columns the sample never saw get the widest cell
+{
+    return k < E.csv.ncols ? E.csv.widths[k] : CSV_MAX_WIDTH;
+}
+
+int editorCsvColStart(int k)
+{
+    if (k <= E.csv.ncols)
+        return E.csv.colstart[k];
+    return E.csv.colstart[E.csv.ncols] + (k - E.csv.ncols) * (CSV_MAX_WIDTH + CSV_SEP_LEN);
+}
+
+int editorCsvField(erow *row, int cx) // field the char at cx belongs to (binary search)
+{
+    int lo = 0, hi = row->nfields - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if (row->fields[mid] <= cx)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+int editorCsvCxToRx(erow *row, int cx)
+{
+    if (row->nfields == 0)
+        return 0;
+    int k = editorCsvField(row, cx);
+    int in = cx - row->fields[k];
+    int w = editorCsvWidth(k);
+    return editorCsvColStart(k) + (in < w ? in : w);
+}
+
+void editorCsvEnable(char delim)
+{
+    E.csv.active = 1;
+    E.csv.delim = delim;
+    editorCsvIndexAll();
+    editorCsvMeasure();
+}
+
+void editorCsvDisable()
+{
+    int j;
+    for (j = 0; j < E.numrows; j++)
+    {
+        free(E.row[j].fields);
+        E.row[j].fields = NULL;
+        E.row[j].nfields = 0;
+    }
+    free(E.csv.widths);
+    free(E.csv.colstart);
+    memset(&E.csv, 0, sizeof(E.csv));
+}
+
+void editorCsvOpen() // files named .csv/.tsv open in the column view
+{
+    char *ext = strrchr(E.filename, '.');
+    if (!ext)
+        return;
+    if (strcasecmp(ext, ".csv") == 0)
+        editorCsvEnable(',');
+    else if (strcasecmp(ext, ".tsv") == 0 || strcasecmp(ext, ".tab") == 0)
+        editorCsvEnable('\t');
+}
+
+void editorCsvToggle() // Ctl+T, the delimiter is whichever of , tab ; the first row has most of
+{
+    if (E.hex.active)
+        return;
+    if (E.csv.active)
+    {
+        editorCsvDisable();
+        editorSetStatusMessage("Column view off");
+        return;
+    }
+
+    const char *cand = ",\t;|";
+    char delim = 0;
+    int best = 0, i;
+    for (i = 0; E.numrows > 0 && cand[i]; i++)
+    {
+        int n = csvCountDelims(E.row[0].chars, E.row[0].size, cand[i]);
+        if (n > best)
+        {
+            best = n;
+            delim = cand[i];
+        }
+    }
+    if (!delim)
+    {
+        editorSetStatusMessage("No delimiter in the first line");
+        return;
+    }
+    editorCsvEnable(delim);
+    editorSetStatusMessage("Column view, %d columns", E.csv.ncols);
+}
+
+void editorCsvNextCell(int dir) // Tab / Shift+Tab
+{
+    if (E.cy >= E.numrows)
+        return;
+    erow *row = &E.row[E.cy];
+    int k = row->nfields ? editorCsvField(row, E.cx) : 0;
+
+    if (dir > 0 && k + 1 < row->nfields)
+        E.cx = row->fields[k + 1];
+    else if (dir < 0 && k > 0)
+        E.cx = row->fields[k - 1];
+    else if (dir > 0)
+    {
+        E.cy = editorFoldNextRow(E.cy, 1);
+        E.cx = 0;
+    }
+    else if (E.cy > 0)
+    {
+        E.cy = editorFoldNextRow(E.cy, -1);
+        row = &E.row[E.cy];
+        E.cx = row->nfields ? row->fields[row->nfields - 1] : 0;
+    }
+}
+
+struct csvKey
+{
+    const char *s; // field text without surrounding quotes
+    int len;
+    int isnum;
+    double num;
+    int row;
+};
+
+int csvSortDesc;
+
+int csvKeyCmp(const struct csvKey *a, const struct csvKey *b) // numbers before text, numbers by value
+{
+    if (a->isnum != b->isnum)
+        return a->isnum ? -1 : 1;
+    if (a->isnum)
+        return (a->num > b->num) - (a->num < b->num);
+    int r = memcmp(a->s, b->s, a->len < b->len ? a->len : b->len);
+    return r ? r : (a->len > b->len) - (a->len < b->len);
+}
+
+int csvSortCmp(const void *a, const void *b)
+{
+    const struct csvKey *x = a, *y = b;
+    int r = csvKeyCmp(x, y);
+    if (r == 0) // stable: equal keys keep their order
+        return (x->row > y->row) - (x->row < y->row);
+    return csvSortDesc ? -r : r;
+}
+
+void editorCsvSort() // Ctl+R: sort the rows below the header by the column under the cursor, again to reverse
+{
+    if (E.cy >= E.numrows || E.numrows < 3)
+        return;
+
+    int col = editorCsvField(&E.row[E.cy], E.cx);
+    int n = E.numrows - 1;
+    struct csvKey *keys = malloc(sizeof(struct csvKey) * n);
+    int j;
+
+    for (j = 0; j < n; j++)
+    {
+        erow *row = &E.row[j + 1];
+        struct csvKey *key = &keys[j];
+        key->row = j + 1;
+        key->s = "";
+        key->len = 0;
+        if (col < row->nfields)
+        {
+            key->s = row->chars + row->fields[col];
+            key->len = (col + 1 < row->nfields ? row->fields[col + 1] - 1 : row->size) - row->fields[col];
+        }
+        if (key->len >= 2 && key->s[0] == '"' && key->s[key->len - 1] == '"')
+        {
+            key->s++;
+            key->len -= 2;
+        }
+
+        char num[64];
+        char *end;
+        key->isnum = 0;
+        if (key->len > 0 && key->len < (int)sizeof(num))
+        {
+            memcpy(num, key->s, key->len);
+            num[key->len] = '\0';
+            key->num = strtod(num, &end);
+            while (isspace((unsigned char)*end))
+                end++;
+            key->isnum = end != num && *end == '\0';
+        }
+    }
+
+    csvSortDesc = 1; // already ascending: reverse it
+    for (j = 1; j < n && csvSortDesc; j++)
+        if (csvKeyCmp(&keys[j - 1], &keys[j]) > 0)
+            csvSortDesc = 0;
+    qsort(keys, n, sizeof(struct csvKey), csvSortCmp);
+
+    erow *rows = malloc(sizeof(erow) * E.numrows);
+    int cy = E.cy;
+    rows[0] = E.row[0];
+    for (j = 0; j < n; j++)
+    {
+        rows[j + 1] = E.row[keys[j].row];
+        if (keys[j].row != j + 1)
+            editorMarkDirty(j + 1); // moved rows keep their disk offsets, the save planner sees they moved
+        if (keys[j].row == E.cy)
+            cy = j + 1;
+    }
+    memcpy(E.row, rows, sizeof(erow) * E.numrows);
+    free(rows);
+    free(keys);
+
+    E.nav.valid = 0; // every row may have moved
+    E.rowsmoved = 1;
+    foldFreeTree(E.folds);
+    E.folds = NULL;
+    editorCursorsClear();
+    E.cy = cy; // the cursor stays on its row
+    E.dirty++;
+    editorSetStatusMessage("Sorted by column %d, %s", col + 1, csvSortDesc ? "descending" : "ascending");
+}
+
+/***    disk changes    ***/
+/*the file as of the last load/save is kept as hashes of runs of whole lines.
+a clean buffer holds exactly those lines, so the hashes are computed from the
+rows and never need the file read again. when the file's size or mtime moves,
+the new file is hashed over the same runs: runs that still match at the start
+and (shifted by the size change) at the end are kept, and only the lines in
+between are read back into rows. with unsaved edits nothing is reloaded, the
+user is warned and a save asks before overwriting*/
+
+uint64_t hashMix(uint64_t h, uint64_t w)
+{
+    h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 29);
+}
+
+uint64_t hashLine(uint64_t h, const char *s, long long len, long long rawlen) // line text a word at a time, then its length on disk
+{
+    uint64_t w;
+    while (len >= 8)
+    {
+        memcpy(&w, s, 8);
+        h = hashMix(h, w);
+        s += 8;
+        len -= 8;
+    }
+    w = 0;
+    memcpy(&w, s, len);
+    h = hashMix(h, w);
+    return hashMix(h, rawlen);
+}
+
+uint64_t hashMapped(const char *p, long long len) // bytes of the file, split into lines like editorOpen does
+{
+    const char *end = p + len;
+    uint64_t h = 0;
+
+    while (p < end)
+    {
+        const char *nl = memchr(p, '\n', end - p);
+        long long raw = (nl ? nl + 1 : end) - p, clen = raw;
+        while (clen > 0 && (p[clen - 1] == '\n' || p[clen - 1] == '\r'))
+            clen--;
+        h = hashLine(h, p, clen, raw);
+        p += raw;
+    }
+    return h;
+}
+
+void editorChunkPush(struct diskChunk *c)
+{
+    if (E.nchunks == E.chunkcap)
+    {
+        E.chunkcap = E.chunkcap ? E.chunkcap * 2 : 16;
+        E.chunks = realloc(E.chunks, sizeof(struct diskChunk) * E.chunkcap);
+        if (E.chunks == NULL)
+            die("realloc");
+    }
+    E.chunks[E.nchunks++] = *c;
+}
+
+void editorChunksAppend(int from, int to) // hash rows from..to-1, which must match the file byte for byte
+{
+    struct diskChunk c;
+    int j;
+
+    c.len = 0;
+    for (j = from; j < to; j++)
+    {
+        erow *row = &E.row[j];
+        if (c.len == 0)
+        {
+            c.off = row->diskoff;
+            c.firstrow = j;
+            c.nrows = 0;
+            c.hash = 0;
+        }
+        c.hash = hashLine(c.hash, row->chars, row->size, row->disklen);
+        c.len += row->disklen;
+        c.nrows++;
+        if (c.len >= DISK_CHUNK)
+        {
+            editorChunkPush(&c);
+            c.len = 0;
+        }
+    }
+    if (c.len > 0)
+        editorChunkPush(&c);
+}
+
+void editorChunksRebuild(long long from) // the file changed from byte offset from on, rehash from there
+{
+    int k = 0;
+    while (k < E.nchunks && E.chunks[k].off + E.chunks[k].len <= from)
+        k++;
+
+    int row = 0;
+    if (k < E.nchunks)
+        row = E.chunks[k].firstrow;
+    else if (k > 0)
+        row = E.chunks[k - 1].firstrow + E.chunks[k - 1].nrows;
+    E.nchunks = k;
+    editorChunksAppend(row, E.numrows);
+}
+
+int editorRowAtDiskOff(long long off, int lo) // first row from lo on that starts at or after off (diskoffs ascend after a save)
+{
+    int hi = E.numrows;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (E.row[mid].diskoff < off)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*after an in-place save that wrote extents ex[0..n-1] of a file now size bytes
+long. a chunk no extent touched holds the same bytes at the same offset (the
+planner only skips rows that didn't move), so it is kept and just renumbered;
+the rows in the gaps between kept chunks are hashed again*/
+void editorChunksSaved(struct saveExtent *ex, int n, long long size)
+{
+    struct diskChunk *old = E.chunks;
+    int nold = E.nchunks, k, e = 0, row = 0;
+
+    E.chunks = NULL;
+    E.nchunks = E.chunkcap = 0;
+    for (k = 0; k < nold; k++)
+    {
+        struct diskChunk c = old[k];
+        while (e < n && ex[e].off + ex[e].len <= c.off)
+            e++;
+        if ((e < n && ex[e].off < c.off + c.len) || c.off + c.len > size) // written over, or cut off
+            continue;
+
+        int first = editorRowAtDiskOff(c.off, row);
+        editorChunksAppend(row, first);
+        c.firstrow = first;
+        editorChunkPush(&c);
+        row = first + c.nrows;
+    }
+    editorChunksAppend(row, E.numrows);
+    free(old);
+}
+
+/*replace rows at..at+ndel-1 with the lines in buf, which sits at off in the
+file. rows after them move by the difference in one go, as do their disk
+offsets (by delta bytes)*/
+void editorSpliceRows(int at, int ndel, const char *buf, long long len, long long off, long long delta)
+{
+    const char *p, *end = buf + len;
+    int nnew = 0, j;
+
+    for (p = buf; p < end; nnew++)
+    {
+        const char *nl = memchr(p, '\n', end - p);
+        p = nl ? nl + 1 : end;
+    }
+
+    for (j = at; j < at + ndel; j++)
+    {
+        editorStatsRemoveRow(&E.row[j]);
+        if (E.row[j].render)
+            E.renderbytes -= E.row[j].rsize + 1;
+        editorFreeRow(&E.row[j]);
+        editorFoldRowDeleted(at);
+    }
+
+    editorReserveRows(E.numrows - ndel + nnew);
+    memmove(&E.row[at + nnew], &E.row[at + ndel], sizeof(erow) * (E.numrows - at - ndel));
+    E.numrows += nnew - ndel;
+    E.nav.valid = 0;
+
+    for (p = buf, j = at; p < end; j++)
+    {
+        const char *nl = memchr(p, '\n', end - p);
+        long long raw = (nl ? nl + 1 : end) - p, clen = raw;
+        while (clen > 0 && (p[clen - 1] == '\n' || p[clen - 1] == '\r'))
+            clen--;
+        editorFoldRowInserted(j);
+        editorInitRow(&E.row[j], p, clen);
+        E.row[j].diskoff = off + (p - buf);
+        E.row[j].disklen = raw;
+        p += raw;
+    }
+
+    for (; j < E.numrows; j++)
+        E.row[j].diskoff += delta;
+}
+
+void editorReloadChanged() // buffer is clean: read back only the lines that differ from the file now
+{
+    struct stat st;
+    int fd = open(E.filename, O_RDONLY);
+    char *map = NULL;
+
+    if (fd == -1 || fstat(fd, &st) == -1)
+        goto out;
+    if (st.st_size > 0)
+    {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            map = NULL;
+            goto out;
+        }
+    }
+
+    long long size = st.st_size, delta = size - E.disksize;
+    int n = E.nchunks, pre = 0, suf = 0;
+
+    while (pre < n) // equal runs from the start, each must still end a line
+    {
+        struct diskChunk *c = &E.chunks[pre];
+        long long end = c->off + c->len;
+        if (end > size || (end < size && map[end - 1] != '\n') || hashMapped(map + c->off, c->len) != c->hash)
+            break;
+        pre++;
+    }
+    long long from = pre ? E.chunks[pre - 1].off + E.chunks[pre - 1].len : 0;
+
+    while (suf < n - pre) // and from the end, shifted by the change in size, each must start a line
+    {
+        struct diskChunk *c = &E.chunks[n - 1 - suf];
+        long long off = c->off + delta;
+        if (off < from || (off > 0 && map[off - 1] != '\n') || hashMapped(map + off, c->len) != c->hash)
+            break;
+        suf++;
+    }
+
+    int r0 = pre < n ? E.chunks[pre].firstrow : E.numrows;
+    int r1 = suf ? E.chunks[n - suf].firstrow : E.numrows;
+    long long to = suf ? E.chunks[n - suf].off + delta : size;
+    int before = E.numrows;
+
+    editorSpliceRows(r0, r1 - r0, map ? map + from : "", to - from, from, delta);
+    int nnew = E.numrows - before + (r1 - r0);
+
+    struct diskChunk *old = E.chunks;
+    int j;
+    E.chunks = NULL;
+    E.nchunks = E.chunkcap = 0;
+    for (j = 0; j < pre; j++)
+        editorChunkPush(&old[j]);
+    editorChunksAppend(r0, r0 + nnew);
+    for (j = n - suf; j < n; j++)
+    {
+        old[j].off += delta;
+        old[j].firstrow += nnew - (r1 - r0);
+        editorChunkPush(&old[j]);
+    }
+    free(old);
+
+    editorCursorsClear();
+    if (E.cy > E.numrows)
+        E.cy = E.numrows;
+    if (E.cx > (E.cy < E.numrows ? E.row[E.cy].size : 0))
+        E.cx = E.cy < E.numrows ? E.row[E.cy].size : 0;
+
+    editorDiskSynced();
+    editorDiskStat(&st); // what we mapped; a writer racing us since then is noticed next time round
+    if (E.indexpath)
+    {
+        struct lineIndex li = {NULL, 0, 0, 0};
+        for (j = 0; j < E.numrows; j++)
+            lineIndexAppend(&li, &E.row[j], E.row[j].disklen);
+        editorIndexWrite(&st, &li);
+        free(li.data);
+    }
+    E.dirty = 0;
+    E.diskwarned = 0;
+    if (r1 > r0 || nnew > 0)
+        editorSetStatusMessage("Changed on disk: reloaded %d lines in place of %d at line %d", nnew, r1 - r0, r0 + 1);
+
+out:
+    if (map)
+        munmap(map, st.st_size);
+    if (fd != -1)
+        close(fd);
+}
+
+int editorDiskChanged(struct stat *st) // st is not the file we last loaded/saved
+{
+    return E.disksize >= 0 && (st->st_size != E.disksize || st->st_mtim.tv_sec != E.diskmtime.tv_sec ||
+                               st->st_mtim.tv_nsec != E.diskmtime.tv_nsec);
+}
+
+void editorCheckDisk() // main loop: notice the file being changed by someone else
+{
+    struct stat st;
+
+    if (!E.filename || E.hex.active || stat(E.filename, &st) == -1 || !editorDiskChanged(&st))
+        return;
+
+    if (!E.dirty)
+        editorReloadChanged();
+    else if (!E.diskwarned)
+    {
+        editorSetStatusMessage("WARNING!!! File changed on disk. Saving now will ask before overwriting it.");
+        E.diskwarned = 1;
+    }
+}
+
+/***    file i/o    ***/
+
+int editorOpen(char *filename, int hex) // into an empty E, hex forces the hex view. 0, or -1 with errno set and E still empty
+{
+    struct stat st;
+
+    if (stat(filename, &st) == 0 && !S_ISREG(st.st_mode)) // a fifo would block, a socket or device is no file to edit
+    {
+        errno = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+        return -1;
+    }
+
+    editorJournalRecover(filename);
+
+    FILE *fp = fopen(filename, "r"); // open file in read mode
+    if (!fp)
+        return -1; // error handling
+    if (fstat(fileno(fp), &st) == -1) // the snapshot we're about to read, anything later shows up as a change
+    {
+        int err = errno;
+        fclose(fp);
+        errno = err;
+        return -1;
+    }
+
+    free(E.filename);
+    E.filename = strdup(filename); // also allocates required amt of memory that u freed
+
+    if (hex || editorIsBinary(fileno(fp)))
+    {
+        fclose(fp);
+        if (editorHexOpen(filename) == -1)
+        {
+            free(E.filename);
+            E.filename = NULL;
+            return -1;
+        }
+        return 0;
+    }
+
+    free(E.indexpath);
+    E.indexpath = editorIndexPath(filename);
+
+    if (editorIndexLoad(fileno(fp), &st) == 0) // unchanged since last time, rows come straight from the index
+    {
+        editorDiskSynced();
+        editorDiskStat(&st);
+        editorChunksRebuild(0);
+        fclose(fp);
+        editorCsvOpen();
+        E.dirty = 0;
+        return 0;
+    }
+
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen; // signed size_t. it can return -1 when error
+    struct lineIndex li = {NULL, 0, 0, 0};
+    long long off = 0;
+
+    while ((linelen = getline(&line, &linecap, fp)) != -1) // parse file line by line, getline returns -1 at EOF
+    {
+        ssize_t rawlen = linelen;
+        while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) // we're stripping carriage and newline cuz erow reps one line of text
+            linelen--;
+        editorInsertRow(E.numrows, line, linelen);
+        E.row[E.numrows - 1].diskoff = off;
+        E.row[E.numrows - 1].disklen = rawlen;
+        lineIndexAppend(&li, &E.row[E.numrows - 1], rawlen); // raw length incl. line terminator, for the sidecar index
+        off += rawlen;
+    }
+
+    editorIndexWrite(&st, &li);
+    editorDiskSynced();
+    editorDiskStat(&st);
+    editorChunksRebuild(0);
+
+    free(li.data);
+    free(line);
+    fclose(fp);
+    editorCsvOpen();
+    E.dirty = 0; // initialising doesnt count as a change
+    return 0;
+}
+
+void editorSave() // mapped to ctl+s
+{
+    if (E.hex.active)
+    {
+        editorHexSave();
+        return;
+    }
+
+    if (E.filename == NULL)
+    {
+        E.filename = editorPrompt("Save as: %s (ESC to cancel)");
+
+        if (E.filename == NULL)
+        {
+            editorSetStatusMessage("Save aborted");
+            return;
+        }
+    }
+
+    int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
+    long long len = E.stats.bytes + E.numrows; // rows joined by \n
+    long long written = len;
+    struct stat st;
+    struct saveExtent *ex = NULL;
+    int n = -1, samelines = 0;
+    int j;
+
+    /*Saving users inputs to file he's provided*/
+    if (fd == -1 || fstat(fd, &st) == -1)
+        goto ioerr;
+
+    if (editorDiskChanged(&st)) // someone else wrote the file since we read it
+    {
+        close(fd); // not held across the prompt, a server session can end inside it
+        char *answer = editorPrompt("File changed on disk since it was read. Overwrite it? (y/n) %s");
+        if (answer == NULL || tolower((unsigned char)answer[0]) != 'y')
+        {
+            free(answer);
+            editorSetStatusMessage("Save aborted");
+            return;
+        }
+        free(answer);
+        fd = open(E.filename, O_RDWR | O_CREAT, 0644);
+        if (fd == -1 || fstat(fd, &st) == -1)
+            goto ioerr;
+    }
+
+    n = editorPlanSave(&st, &ex, &samelines);
+    if (n >= 0)
+    {
+        char *jpath = editorJournalPath(E.filename);
+        if (editorJournalWrite(jpath, fd, ex, n, len) == 0)
+        {
+            written = 0;
+            for (j = 0; j < n; j++) // patch the changed extents in place
+            {
+                if (editorWriteRows(fd, ex[j].from, ex[j].to, ex[j].off) == -1)
+                    break;
+                written += ex[j].len;
+            }
+            if (j < n || ftruncate(fd, len) == -1 || fsync(fd) == -1)
+            {
+                int err = errno;
+                free(jpath);
+                close(fd);
+                fd = -1;
+                // roll back now: left for the next open, it would undo whatever good save came in between
+                if (editorJournalRecover(E.filename) == 0 && stat(E.filename, &st) == 0)
+                {
+                    E.disksize = st.st_size; // the bytes are the ones we last loaded/saved again, only the mtime moved
+                    E.diskmtime = st.st_mtim;
+                }
+                errno = err;
+                goto ioerr;
+            }
+            unlink(jpath);
+        }
+        else
+            n = -1; // can't make it crash safe, write the whole thing like before
+        free(jpath);
+    }
+
+    if (n == -1 && (editorWriteRows(fd, 0, E.numrows, 0) == -1 || ftruncate(fd, len) == -1))
+        goto ioerr;
+
+    if (n == -1) // every row now sits at its running offset
+    {
+        char *jpath = editorJournalPath(E.filename);
+        unlink(jpath); // a journal some failed save couldn't replay must not roll this one back
+        free(jpath);
+
+        long long off = 0;
+        for (j = 0; j < E.numrows; j++)
+        {
+            E.row[j].diskoff = off;
+            E.row[j].disklen = E.row[j].size + 1;
+            off += E.row[j].size + 1;
+        }
+    }
+    else
+    {
+        int k;
+        for (j = 0; j < n; j++)
+        {
+            long long off = ex[j].off;
+            for (k = ex[j].from; k < ex[j].to; k++)
+            {
+                E.row[k].diskoff = off;
+                E.row[k].disklen = E.row[k].size + 1;
+                off += E.row[k].size + 1;
+            }
+        }
+    }
+    E.dirtyfirst = E.dirtylast = -1;
+    if (n == -1)
+        editorChunksRebuild(0);
+    else
+        editorChunksSaved(ex, n, len);
+
+    if (!E.indexpath)
+        E.indexpath = editorIndexPath(E.filename);
+    struct stat after;
+    int statok = fstat(fd, &after) == 0; // the file as we left it
+    if (!(n >= 0 && samelines && editorIndexRekey(fd, &st) == 0))
+    {
+        struct lineIndex li = {NULL, 0, 0, 0};
+        for (j = 0; j < E.numrows; j++) // file is now exactly our rows joined by \n
+            lineIndexAppend(&li, &E.row[j], E.row[j].size + 1);
+        editorIndexWrite(statok ? &after : NULL, &li);
+        free(li.data);
+    }
+
+    editorDiskStat(statok ? &after : NULL);
+    close(fd);
+    free(ex);
+    E.dirty = 0; // reseting count of changes
+    E.diskwarned = 0;
+    if (n >= 0)
+        editorSetStatusMessage("%lld of %lld bytes written to disk in place", written, len);
+    else
+        editorSetStatusMessage("%lld bytes written to disk", len);
+    return;
+
+ioerr:
+    if (fd != -1)
+        close(fd);
+    free(ex);
+    editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+}
+/***    append buffer   ***/
+struct abuf
+{
+    char *b;
+    int len;
+    int cap; // allocated bytes, grows geometrically and is kept between frames
+};
+
+#define ABUF_INIT {NULL, 0, 0}
+
+int abReserve(struct abuf *ab, int len) // make room for len more bytes
+{
+    if (ab->len + len <= ab->cap)
+        return 0;
+
+    int cap = ab->cap ? ab->cap : 4096;
+    while (cap < ab->len + len)
+        cap *= 2;
+
+    char *new = realloc(ab->b, cap);
+    if (new == NULL)
+        return -1;
+
+    ab->b = new;
+    ab->cap = cap;
+    return 0;
+}
+
+void abAppend(struct abuf *ab, const char *s, int len) // append all write fncs to buffer
+{
+    if (abReserve(ab, len) == -1)
+        return;
+
+    memcpy(&ab->b[ab->len], s, len);
+    ab->len += len;
+}
+
+void abPad(struct abuf *ab, char c, int n) // append n copies of c, used for padding
+{
+    if (n <= 0 || abReserve(ab, n) == -1)
+        return;
+
+    memset(&ab->b[ab->len], c, n);
+    ab->len += n;
+}
+
+void abReset(struct abuf *ab) // start a new frame, keeping the allocation
+{
+    ab->len = 0;
+}
+
+void abFree(struct abuf *ab) // destructor that deallocates dyn mem used by abuf
+{
+    free(ab->b);
+    ab->b = NULL;
+    ab->len = ab->cap = 0;
+}
+
+/***    output  ***/
+void editorScroll()
+{
+    if (E.folds)
+        editorFoldReveal(E.cy);
+
+    int vy = editorFoldBufToVis(E.cy); // rowoff counts visible rows
+    E.rx = 0;
+    if (E.hex.active)
+        E.rx = editorHexCxToRx(E.cx, E.hex.nibble);
+    else if (E.csv.active && E.cy < E.numrows)
+        E.rx = editorCsvCxToRx(&E.row[E.cy], E.cx);
+    else if (E.cy < E.numrows)
+    {
+        E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+    }
+
+    if (vy < E.rowoff)
+    {
+        E.rowoff = vy;
+    }
+    if (vy >= E.rowoff + E.screenrows)
+    {
+        E.rowoff = vy - E.screenrows + 1;
+    }
+    if (E.rx < E.coloff)
+    {
+        E.coloff = E.rx;
+    }
     if (E.rx >= E.coloff + E.screencols)
     {
         E.coloff = E.rx - E.screencols + 1;
     }
+    if (E.coloff > 0 && !E.hex.active && !E.csv.active && E.stats.maxwidth < E.coloff + E.screencols - 1) // never scroll right past the longest line
+    {
+        E.coloff = E.stats.maxwidth - E.screencols + 1;
+        if (E.coloff > E.rx)
+            E.coloff = E.rx;
+        if (E.coloff < 0)
+            E.coloff = 0;
+    }
+}
+
+void editorDrawCursors(struct abuf *ab, int filerow, int len) // visible part of a row with extra cursors in inverse video
+{
+    erow *row = &E.row[filerow];
+    char *render = editorRowRender(row);
+    int j = editorCursorsFirstOnRow(filerow);
+    int at = E.coloff; // next render column to emit
+
+    for (; j < E.ncursors && E.cursors[j].cy == filerow; j++)
+    {
+        int rx = editorRowCxToRx(row, E.cursors[j].cx);
+        if (rx < at || rx >= E.coloff + E.screencols)
+            continue;
+        if (rx > at)
+            abAppend(ab, &render[at], (rx < E.coloff + len ? rx : E.coloff + len) - at);
+        abAppend(ab, "\x1b[7m", 4);
+        abAppend(ab, rx < row->rsize ? &render[rx] : " ", 1); // past the end: a block
+        abAppend(ab, "\x1b[m", 3);
+        at = rx + 1;
+    }
+    if (at < E.coloff + len)
+        abAppend(ab, &render[at], E.coloff + len - at);
+}
+
+/*the visible part of a row in the column view. cells left of the screen are
+skipped by their start column, and building stops at the right edge*/
+int editorCsvDrawRow(struct abuf *ab, int filerow) // returns the columns drawn
+{
+    static struct abuf line = ABUF_INIT;
+    erow *row = &E.row[filerow];
+    int k = 0, lo = 0, hi = row->nfields;
+
+    while (lo < hi) // first cell that reaches coloff
+    {
+        int mid = (lo + hi) / 2;
+        if (editorCsvColStart(mid + 1) <= E.coloff)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    k = lo;
+
+    int base = editorCsvColStart(k);
+    abReset(&line);
+    for (; k < row->nfields && base + line.len < E.coloff + E.screencols; k++)
+    {
+        int start = row->fields[k];
+        int len = (k + 1 < row->nfields ? row->fields[k + 1] - 1 : row->size) - start;
+        int w = editorCsvWidth(k);
+        int j;
+
+        if (len > w)
+            len = w;
+        abReserve(&line, w + CSV_SEP_LEN);
+        for (j = 0; j < len; j++)
+        {
+            char c = row->chars[start + j];
+            line.b[line.len + j] = iscntrl((unsigned char)c) ? ' ' : c;
+        }
+        line.len += len;
+        abPad(&line, ' ', w - len);
+        if (k + 1 < row->nfields)
+            abAppend(&line, CSV_SEP, CSV_SEP_LEN);
+    }
+
+    int skip = E.coloff - base;
+    int len = line.len - skip;
+    if (len > E.screencols)
+        len = E.screencols;
+    if (len <= 0)
+        return 0;
+    abAppend(ab, &line.b[skip], len);
+    return len;
 }
 
 void editorDrawRows(struct abuf *ab) // draw ~ like vim
@@ -573,7 +3930,7 @@ void editorDrawRows(struct abuf *ab) // draw ~ like vim
     int y;
     for (y = 0; y < E.screenrows; y++)
     {
-        int filerow = y + E.rowoff;
+        int filerow = editorFoldVisToBuf(y + E.rowoff);
         if (filerow >= E.numrows)
         {
             if (E.numrows == 0 && y == E.screenrows / 3)
@@ -589,8 +3946,7 @@ void editorDrawRows(struct abuf *ab) // draw ~ like vim
                     abAppend(ab, "~", 1);
                     padding--;
                 }
-                while (padding--)
-                    abAppend(ab, " ", 1);
+                abPad(ab, ' ', padding);
                 abAppend(ab, welcome, welcomelen);
             }
             else
@@ -600,12 +3956,41 @@ void editorDrawRows(struct abuf *ab) // draw ~ like vim
         }
         else
         {
-            int len = E.row[filerow].rsize - E.coloff;
+            char hexline[96];
+            char *render = E.hex.active ? NULL : editorRowRender(&E.row[filerow]);
+            int len;
+
+            if (E.hex.active)
+            {
+                len = editorHexRender(filerow, hexline);
+                render = hexline;
+            }
+            else
+                len = E.row[filerow].rsize;
+
+            len -= E.coloff;
             if (len < 0)
                 len = 0;
             if (len > E.screencols)
                 len = E.screencols;
-            abAppend(ab, &E.row[filerow].render[E.coloff], len);
+            if (E.csv.active && !E.hex.active)
+                len = editorCsvDrawRow(ab, filerow);
+            else if (E.ncursors > 0 && !E.hex.active)
+                editorDrawCursors(ab, filerow, len);
+            else if (len > 0)
+                abAppend(ab, &render[E.coloff], len);
+
+            foldNode *f = E.folds ? editorFoldFind(filerow) : NULL;
+            if (f && f->start == filerow && len < E.screencols) // folded header: say how much is hidden
+            {
+                char tag[32];
+                int taglen = snprintf(tag, sizeof(tag), " [+%d lines]", f->end - f->start);
+                if (taglen > E.screencols - len)
+                    taglen = E.screencols - len;
+                abAppend(ab, "\x1b[7m", 4);
+                abAppend(ab, tag, taglen);
+                abAppend(ab, "\x1b[m", 3);
+            }
         }
         abAppend(ab, "\x1b[K", 3);
         abAppend(ab, "\r\n", 2);
@@ -615,31 +4000,50 @@ void editorDrawRows(struct abuf *ab) // draw ~ like vim
 void editorDrawStatusBar(struct abuf *ab)
 {
     abAppend(ab, "\x1b[7m", 4); // esc seq that switches to inverted colours
-    char status[80], rstatus[80];
+    char status[160], rstatus[80];
+    int len, rlen;
 
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
+    if (E.hex.active)
+    {
+        len = snprintf(status, sizeof(status), "%.20s - hex, %lld bytes%s %s",
+                       E.filename, E.hex.size, E.hex.readonly ? " [read-only]" : "",
+                       E.dirty ? "(modified)" : "");
+        rlen = snprintf(rstatus, sizeof(rstatus), "0x%llx/0x%llx",
+                        editorHexOffset(), E.hex.size);
+    }
+    else
+    {
+        len = snprintf(status, sizeof(status), "%.20s - %d lines, %lld words, %lld chars, %lld bytes %s",
                        E.filename ? E.filename : "[No Name]", E.numrows,
+                       E.stats.words, E.stats.chars + E.numrows, E.stats.bytes + E.numrows, // + newlines
                        E.dirty ? "(modified)" : ""); // no name
 
-    int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d", E.cy + 1, E.numrows); // line no.
+        if (E.csv.active && E.cy < E.numrows && E.row[E.cy].nfields > 0)
+            rlen = snprintf(rstatus, sizeof(rstatus), "cell %d/%d  %d/%d", editorCsvField(&E.row[E.cy], E.cx) + 1,
+                            E.row[E.cy].nfields, E.cy + 1, E.numrows);
+        else
+            rlen = snprintf(rstatus, sizeof(rstatus), "col %d/%d  %d/%d", E.rx + 1, E.stats.maxwidth + 1,
+                            E.cy + 1, E.numrows); // line no.
+    }
 
+    if (len >= (int)sizeof(status))
+        len = sizeof(status) - 1;
+    if (rlen >= (int)sizeof(rstatus))
+        rlen = sizeof(rstatus) - 1;
     if (len > E.screencols) // make sure name fits
         len = E.screencols;
 
     abAppend(ab, status, len);
 
-    while (len < E.screencols) // insert whitespace until screen edge
+    if (len < E.screencols) // insert whitespace until screen edge, right status flush right
     {
-        if (E.screencols - len == rlen)
+        if (E.screencols - len >= rlen)
         {
+            abPad(ab, ' ', E.screencols - len - rlen);
             abAppend(ab, rstatus, rlen);
-            break;
         }
         else
-        {
-            abAppend(ab, " ", 1);
-            len++;
-        }
+            abPad(ab, ' ', E.screencols - len);
     }
     abAppend(ab, "\x1b[m", 3); // esc seq that switches back to normal formatting
     abAppend(ab, "\r\n", 2);   // space to display status message
@@ -659,9 +4063,13 @@ void editorDrawMessageBar(struct abuf *ab)
 
 void editorRefreshScreen()
 {
+    static struct abuf ab = ABUF_INIT; // reused every frame so steady state does no allocation
+
     editorScroll();
+    abReset(&ab);
 
-    struct abuf ab = ABUF_INIT;
+    if (E.syncoutput)
+        abAppend(&ab, "\x1b[?2026h", 8); // begin synchronized update, terminal holds the repaint
 
     abAppend(&ab, "\x1b[?25l", 6); // reset mode
     /*abAppend(&ab, "\x1b[2J", 4);   // clear the terminal to the left side of the cursor. we hv optimized this by clearing line wise at each refresh*/
@@ -672,13 +4080,20 @@ void editorRefreshScreen()
     editorDrawMessageBar(&ab);
 
     char buf[32];
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, (E.rx - E.coloff) + 1); // terminal uses 1-indexed values, thus updated cs,cy
+    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (editorFoldBufToVis(E.cy) - E.rowoff) + 1, (E.rx - E.coloff) + 1); // terminal uses 1-indexed values, thus updated cs,cy
     abAppend(&ab, buf, strlen(buf));
 
     abAppend(&ab, "\x1b[?25h", 6); // set mode
 
-    write(STDOUT_FILENO, ab.b, ab.len); //\x1b==esc
-    abFree(&ab);
+    if (E.syncoutput)
+        abAppend(&ab, "\x1b[?2026l", 8); // end synchronized update, frame is shown at once
+
+    if (editorWriteAll(E.outfd, ab.b, ab.len) == -1) //\x1b==esc
+    {
+        if (E.server) // client went away mid-frame
+            longjmp(sessionEnd, 1);
+        die("write");
+    }
 }
 
 void editorSetStatusMessage(const char *fmt, ...)
@@ -700,8 +4115,10 @@ char *editorPrompt(char *prompt)
     while (1)
     {
         editorSetStatusMessage(prompt, buf);
+        promptbuf = buf;
         editorRefreshScreen();
         int c = editorReadKey();
+        promptbuf = NULL;
 
         if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE)
         {
@@ -748,7 +4165,7 @@ void editorMoveCursor(int key)
             E.cx--;
         else if (E.cy > 0)
         {
-            E.cy--;
+            E.cy = editorFoldNextRow(E.cy, -1); // skips folded rows
             E.cx = E.row[E.cy].size;
         }
         break;
@@ -757,17 +4174,17 @@ void editorMoveCursor(int key)
             E.cx++;
         else if (row && E.cx == row->size)
         {
-            E.cy++;
+            E.cy = editorFoldNextRow(E.cy, 1);
             E.cx = 0;
         }
         break;
     case ARROW_UP:
         if (E.cy != 0)
-            E.cy--;
+            E.cy = editorFoldNextRow(E.cy, -1);
         break;
     case ARROW_DOWN:
         if (E.cy < E.numrows)
-            E.cy++;
+            E.cy = editorFoldNextRow(E.cy, 1);
         break;
     }
 
@@ -784,23 +4201,38 @@ void editorProcessKeypress()
     static int quit_times = KILO_QUIT_TIMES;
     int c = editorReadKey();
 
+    if (E.hex.active && editorHexProcessKey(c))
+    {
+        quit_times = KILO_QUIT_TIMES;
+        return;
+    }
+
     switch (c)
     {
 
     case '\r':
+        editorCursorsClear(); // new rows would shift the other cursors, enter is primary only
         editorInsertNewline();
         break;
 
     case CTRL_KEY('q'):
-        if (E.dirty && quit_times > 0) // to quit with unsaved changes, 3 ctl+q
+        if ((E.dirty || editorBuffersDirty()) && quit_times > 0 && !E.server) // to quit with unsaved changes, 3 ctl+q
         {
-            editorSetStatusMessage("WARNING!!! File has unsaved changes. "
-                                   "Press Ctrl-Q %d more times to quit.",
-                                   quit_times);
+            if (E.dirty)
+                editorSetStatusMessage("WARNING!!! File has unsaved changes. "
+                                       "Press Ctrl-Q %d more times to quit.",
+                                       quit_times);
+            else
+                editorSetStatusMessage("WARNING!!! %d other buffers have unsaved changes. "
+                                       "Press Ctrl-Q %d more times to quit.",
+                                       editorBuffersDirty(), quit_times);
             quit_times--;
             return;
         }
 
+        editorIndexSaveCursor();
+        if (E.server) // detach, the buffer stays loaded in the server
+            longjmp(sessionEnd, 1);
         write(STDOUT_FILENO, "\x1b[2J", 4); // clear and reposition cursor upon exit
         write(STDOUT_FILENO, "\x1b[H", 3);
         exit(0);
@@ -821,47 +4253,96 @@ void editorProcessKeypress()
     case BACKSPACE:
     case CTRL_KEY('h'):
     case DEL_KEY:
+        if (E.ncursors > 0)
+        {
+            editorMultiDelChar(c == DEL_KEY);
+            break;
+        }
         if (c == DEL_KEY) // del == → + bckspace
             editorMoveCursor(ARROW_RIGHT);
 
         editorDelChar();
         break;
 
-    case PAGE_UP:
+    case PAGE_UP: // jump a whole page from the top/bottom of the screen in one go
+        editorGotoRow(editorFoldVisToBuf(E.rowoff > E.screenrows ? E.rowoff - E.screenrows : 0));
+        break;
     case PAGE_DOWN:
-    {
-        if (c == PAGE_DOWN)
-        {
-            E.cy = E.rowoff; // simulate the whole pages worth of scrolls
-        }
-        else if (c == PAGE_DOWN)
-        {
-            E.cy = E.rowoff + E.screenrows - 1;
-            if (E.cy > E.numrows)
-                E.cy = E.numrows;
-        }
+        editorGotoRow(editorFoldVisToBuf(E.rowoff + 2 * E.screenrows - 1));
+        break;
+
+    case CTRL_KEY('k'):
+        editorToggleFold();
+        break;
+
+    case CTRL_KEY('g'):
+        editorGoto();
+        break;
+
+    case CTRL_KEY('b'):
+        if (editorMatchBracket() == -1)
+            editorSetStatusMessage("No matching bracket");
+        break;
+
+    case CTRL_KEY('d'):
+        editorCursorAddNextMatch();
+        break;
 
-        int times = E.screenrows;
-        while (times--)
+    case CTRL_KEY('t'):
+        editorCsvToggle();
+        break;
+
+    case CTRL_KEY('o'):
+        editorBufferOpen();
+        break;
+    case CTRL_KEY('n'):
+        editorBufferNext();
+        break;
+    case CTRL_KEY('r'):
+        if (E.csv.active)
+            editorCsvSort();
+        break;
+    case SHIFT_TAB:
+        if (E.csv.active)
+            editorCsvNextCell(-1);
+        break;
+    case '\t':
+        if (E.csv.active) // tab moves between cells, Ctl+T first to type one
         {
-            editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN); // call move cursor reqd times using ternary
+            editorCsvNextCell(1);
+            break;
         }
+        if (E.ncursors > 0)
+            editorMultiInsertChar(c);
+        else
+            editorInsertChar(c);
+        break;
+    case SHIFT_ARROW_UP:
+    case SHIFT_ARROW_DOWN:
+        editorCursorAddColumn(c == SHIFT_ARROW_UP ? -1 : 1);
         break;
-    }
 
     case ARROW_UP:
     case ARROW_DOWN:
     case ARROW_LEFT:
     case ARROW_RIGHT:
-        editorMoveCursor(c); // function that uses wsad to move cursor around
+        if (E.ncursors > 0)
+            editorMultiMove(c);
+        else
+            editorMoveCursor(c); // function that uses wsad to move cursor around
         break;
 
-    case CTRL_KEY('l'):
     case '\x1b': // a redundancy for accidental esc sequences (they are being ignored)
+        editorCursorsClear(); // plain esc also drops the extra cursors
+        break;
+    case CTRL_KEY('l'):
         break;
 
     default:
-        editorInsertChar(c); // for text editing as default
+        if (E.ncursors > 0)
+            editorMultiInsertChar(c);
+        else
+            editorInsertChar(c); // for text editing as default
         break;
     }
 
@@ -869,7 +4350,7 @@ void editorProcessKeypress()
 }
 
 /***    init    ***/
-void initEditor()
+void initDocument() // empty document state, leaves the terminal side of E alone
 {
     E.cx = 0;
     E.cy = 0;
@@ -877,34 +4358,637 @@ void initEditor()
     E.numrows = 0;
     E.rowoff = 0; // row
     E.coloff = 0;
+    E.rowcap = 0;
     E.row = NULL;
     E.filename = NULL;
+    E.indexpath = NULL;
+    E.dirtyfirst = E.dirtylast = -1;
+    E.disksize = -1;
+    E.disknumrows = 0;
+    E.rowsmoved = 0;
+    E.dirty = 0;
+    memset(&E.stats, 0, sizeof(E.stats));
+    memset(&E.hex, 0, sizeof(E.hex));
+    E.hex.fd = -1;
+    memset(&E.nav, 0, sizeof(E.nav));
+    E.folds = NULL;
+    E.cursors = NULL;
+    E.ncursors = E.cursorcap = 0;
+    memset(&E.csv, 0, sizeof(E.csv));
+    E.chunks = NULL;
+    E.nchunks = E.chunkcap = 0;
+    E.diskwarned = 0;
+}
+
+void initEditor()
+{
+    initDocument();
     E.statusmsg[0] = '\0';
     E.statusmsg_time = 0;
-    E.dirty = 0;
+    E.infd = STDIN_FILENO;
+    E.outfd = STDOUT_FILENO;
+    E.server = 0;
 
     if (getWindowSize(&E.screenrows, &E.screencols) == -1)
         die("getWindowSize");
 
+    E.syncoutput = editorDetectSyncOutput();
+
     E.screenrows -= 2; // status bar, status msg
 }
 
+/***    buffers    ***/
+/*documents that are loaded but not on screen. a parked buffer is a copy of E;
+only the terminal side of E (screen size, fds, status message) belongs to
+whoever is looking at it, so parking and activating are struct copies.
+all buffers share one memory budget. when it's exceeded, inactive buffers
+first lose their render strings (rebuilt on use), then clean ones are
+unloaded down to their name and cursor and read back from disk, through the
+line index, when they're next activated*/
+
+struct editorBuffer
+{
+    struct editorConfig doc;
+    unsigned long lastused; // LRU clock value when it was last active
+    int unloaded;           // doc only has filename and cursor left
+};
+
+struct editorBuffer *buffers;
+int numbuffers;
+unsigned long bufferclock;
+size_t memorybudget = (size_t)BUFFER_BUDGET_MB << 20;
+
+void editorFreeDocument(struct editorConfig *d)
+{
+    int j;
+    for (j = 0; j < d->numrows; j++)
+        editorFreeRow(&d->row[j]);
+    free(d->row);
+    free(d->filename);
+    free(d->indexpath);
+    for (j = 0; j < d->stats.npages; j++)
+        free(d->stats.widthpages[j]);
+    free(d->stats.widthpages);
+    free(d->stats.pagerows);
+    if (d->hex.map)
+        munmap(d->hex.map, d->hex.size);
+    if (d->hex.fd != -1)
+        close(d->hex.fd);
+    free(d->hex.patches);
+    free(d->nav.tree);
+    foldFreeTree(d->folds);
+    free(d->cursors);
+    free(d->csv.widths);
+    free(d->csv.colstart);
+    free(d->chunks);
+}
+
+size_t editorDocumentMemory(struct editorConfig *d) // rough heap footprint: chars + render + row array + malloc overhead
+{
+    if (d->hex.active) // the mapping is page cache, only patched pages are ours
+        return (size_t)d->hex.npatches * 4096;
+    size_t n = (size_t)d->stats.bytes + d->renderbytes + (size_t)d->rowcap * sizeof(erow) + (size_t)d->numrows * 40;
+    if (d->csv.active)
+        n += (size_t)d->numrows * (d->csv.ncols + 1) * sizeof(int);
+    return n;
+}
+
+void editorDropRenders(struct editorConfig *d)
+{
+    int j;
+    for (j = 0; j < d->numrows; j++)
+    {
+        free(d->row[j].render);
+        d->row[j].render = NULL;
+    }
+    d->renderbytes = 0;
+}
+
+void editorLoadDocument(struct editorConfig *doc) // make doc the document in E, keeping the terminal state
+{
+    struct editorConfig term = E;
+
+    E = *doc;
+    E.screenrows = term.screenrows;
+    E.screencols = term.screencols;
+    memcpy(E.statusmsg, term.statusmsg, sizeof(E.statusmsg));
+    E.statusmsg_time = term.statusmsg_time;
+    E.syncoutput = term.syncoutput;
+    E.infd = term.infd;
+    E.outfd = term.outfd;
+    E.server = term.server;
+    E.orig_termios = term.orig_termios;
+}
+
+void editorBufferPark() // move the document in E into the buffer list, E is left empty
+{
+    buffers = realloc(buffers, sizeof(struct editorBuffer) * (numbuffers + 1));
+    if (buffers == NULL)
+        die("realloc");
+    buffers[numbuffers].doc = E;
+    buffers[numbuffers].lastused = ++bufferclock;
+    buffers[numbuffers].unloaded = 0;
+    numbuffers++;
+    initDocument();
+}
+
+int editorBufferStash() // make room in E for another document. 1 if it was parked (as the last buffer)
+{
+    if (!E.filename && !E.dirty && E.numrows == 0) // the untouched empty buffer bitpad starts with
+    {
+        editorFreeDocument(&E);
+        initDocument();
+        return 0;
+    }
+    editorBufferPark();
+    return 1;
+}
+
+void editorBufferUnload(int i) // free a clean parked buffer, keeping what's needed to load it again
+{
+    struct editorConfig *d = &buffers[i].doc;
+    struct editorConfig stub;
+
+    memset(&stub, 0, sizeof(stub));
+    stub.filename = strdup(d->filename);
+    stub.cx = d->cx;
+    stub.cy = d->cy;
+    stub.rowoff = d->rowoff;
+    stub.coloff = d->coloff;
+    stub.hex.active = d->hex.active; // reopened in the same view, -x or not
+    stub.hex.fd = -1;
+    editorFreeDocument(d);
+    *d = stub;
+    buffers[i].unloaded = 1;
+}
+
+void editorBufferRemove(int i)
+{
+    memmove(&buffers[i], &buffers[i + 1], sizeof(struct editorBuffer) * (numbuffers - i - 1));
+    numbuffers--;
+}
+
+int editorBufferActivate(int i) // E must be empty (parked or freed). -1 with errno set if an unloaded one can't be read back
+{
+    struct editorBuffer b = buffers[i];
+
+    editorBufferRemove(i);
+    if (!b.unloaded)
+    {
+        editorLoadDocument(&b.doc);
+        return 0;
+    }
+
+    if (access(b.doc.filename, F_OK) != 0)
+        E.filename = strdup(b.doc.filename);
+    else if (editorOpen(b.doc.filename, b.doc.hex.active) == -1)
+    {
+        b.lastused = ++bufferclock; // stays a stub, at the back of the list so Ctl+N moves past it
+        buffers[numbuffers++] = b;  // removing it left the room
+        return -1;
+    }
+    if (b.doc.cy <= E.numrows) // back where it was when it got unloaded
+    {
+        E.cy = b.doc.cy;
+        E.cx = (E.cy < E.numrows && b.doc.cx <= E.row[E.cy].size) ? b.doc.cx : 0;
+        E.rowoff = b.doc.rowoff <= E.cy ? b.doc.rowoff : E.cy;
+        E.coloff = b.doc.coloff;
+    }
+    free(b.doc.filename);
+    return 0;
+}
+
+int editorBufferFind(const char *filename)
+{
+    int i;
+    for (i = 0; i < numbuffers; i++)
+        if (buffers[i].doc.filename && strcmp(buffers[i].doc.filename, filename) == 0)
+            return i;
+    return -1;
+}
+
+int memoryPressure() // less than a tenth of RAM left (linux, /proc/meminfo); never reported elsewhere
+{
+    FILE *fp = fopen("/proc/meminfo", "r");
+    char line[128];
+    long long total = 0, avail = -1, v;
+
+    if (!fp)
+        return 0;
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (sscanf(line, "MemTotal: %lld kB", &v) == 1)
+            total = v;
+        else if (sscanf(line, "MemAvailable: %lld kB", &v) == 1)
+            avail = v;
+    }
+    fclose(fp);
+    return avail >= 0 && avail < total / 10;
+}
+
+void editorBufferEvict() // shrink least recently used buffers until everything fits the budget
+{
+    int stage;
+
+    for (stage = 0; stage < 2; stage++) // 0: drop render strings, 1: unload clean buffers
+    {
+        while (1)
+        {
+            size_t used = editorDocumentMemory(&E);
+            int i, victim = -1;
+
+            for (i = 0; i < numbuffers; i++)
+            {
+                struct editorConfig *d = &buffers[i].doc;
+                int fits = stage == 0 ? d->renderbytes > 0
+                                      : !buffers[i].unloaded && !d->dirty && d->filename != NULL; // unsaved edits are never thrown away
+                used += editorDocumentMemory(d);
+                if (fits && (victim == -1 || buffers[i].lastused < buffers[victim].lastused))
+                    victim = i;
+            }
+
+            if (victim == -1 || (used <= memorybudget && !memoryPressure()))
+                break;
+
+            if (stage == 0)
+                editorDropRenders(&buffers[victim].doc);
+            else
+                editorBufferUnload(victim);
+        }
+    }
+}
+
+int editorBufferSwitch(int i) // park the document in E and bring up buffer i. if that fails, E is brought back
+{
+    int parked = editorBufferStash(); // parking appends, i stays where it is
+
+    if (editorBufferActivate(i) == -1)
+    {
+        editorSetStatusMessage("Can't open %s: %s", buffers[numbuffers - 1].doc.filename, strerror(errno));
+        if (parked) // it sits just before the stub that went back to the end
+            editorBufferActivate(numbuffers - 2);
+        return -1;
+    }
+    editorBufferEvict();
+    return 0;
+}
+
+void editorBufferNext() // Ctl+N: cycle through the buffers, the one parked longest ago comes up
+{
+    if (numbuffers == 0)
+    {
+        editorSetStatusMessage("No other buffers");
+        return;
+    }
+    if (editorBufferSwitch(0) == 0)
+        editorSetStatusMessage("%s (%d other buffers)", E.filename ? E.filename : "[No Name]", numbuffers);
+}
+
+void editorBufferOpen() // Ctl+O: open a file in a new buffer, or switch to it if it's loaded
+{
+    char *name = editorPrompt("Open: %s (ESC to cancel)");
+    int i, r = 0;
+
+    if (name == NULL)
+        return;
+    if (E.filename && strcmp(E.filename, name) == 0)
+    {
+        free(name);
+        return;
+    }
+
+    i = editorBufferFind(name);
+    if (i >= 0)
+        r = editorBufferSwitch(i);
+    else
+    {
+        int parked = editorBufferStash();
+        if (access(name, F_OK) != 0)
+            E.filename = strdup(name); // new file, created on first save
+        else if ((r = editorOpen(name, 0)) == -1)
+        {
+            editorSetStatusMessage("Can't open %s: %s", name, strerror(errno));
+            if (parked) // back to the buffer we came from
+                editorBufferActivate(numbuffers - 1);
+        }
+        if (r == 0)
+            editorBufferEvict();
+    }
+    if (r == 0)
+        editorSetStatusMessage("%s (%d other buffers)", E.filename, numbuffers);
+    free(name);
+}
+
+int editorBuffersDirty() // parked buffers with unsaved changes
+{
+    int i, n = 0;
+    for (i = 0; i < numbuffers; i++)
+        if (buffers[i].doc.dirty)
+            n++;
+    return n;
+}
+
+/***    server    ***/
+/*bitpad -s keeps buffers loaded in one long running process. bitpad -c file
+is a thin client: it puts the terminal in raw mode, sends a hello with the file
+and screen size, then just shovels keystrokes to the socket and frames back to
+the terminal. window changes are sent in-band as <esc>[8;rows;colst. the server
+runs one session at a time on the client's connection and parks the buffer
+when the client quits (Ctrl-Q) or disconnects. a file it can't open, or a
+client arriving while a session runs, gets a one line "bitpad: ..." reply
+instead of a session. the socket lives in a
+directory only the user can enter, and both ends check the other is the same
+user*/
+
+struct serverHello
+{
+    char magic[8];
+    int32_t rows, cols;
+    int32_t syncoutput;
+    char path[PATH_MAX];
+};
+
+volatile sig_atomic_t winchanged;
+
+void serverSocketPath(struct sockaddr_un *addr)
+{
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (dir && *dir)
+        snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/bitpad.sock", dir);
+    else
+        snprintf(addr->sun_path, sizeof(addr->sun_path), "/tmp/bitpad-%d/bitpad.sock", (int)getuid());
+}
+
+int serverSocketDirOk(const char *sockpath, int create) // the socket's directory is ours and closed to others
+{
+    char dir[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    struct stat st;
+
+    snprintf(dir, sizeof(dir), "%s", sockpath);
+    *strrchr(dir, '/') = '\0';
+    if (create)
+        mkdir(dir, 0700);
+    return lstat(dir, &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == getuid() && (st.st_mode & 077) == 0;
+}
+
+int serverPeerOk(int conn) // the client runs as our user
+{
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    return getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(conn, &uid, &gid) == 0 && uid == getuid();
+#endif
+}
+
+void serverRefuseBusy() // one session at a time: tell a second client so instead of leaving it hanging
+{
+    const char *msg = "bitpad: busy, the server is in another session\r\n";
+    int conn = accept(serverlfd, NULL, NULL);
+
+    if (conn == -1)
+        return;
+    if (serverPeerOk(conn))
+        editorWriteAll(conn, msg, strlen(msg));
+    close(conn);
+}
+
+void editorServe(size_t budget)
+{
+    memorybudget = budget;
+    struct sockaddr_un addr;
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (lfd == -1)
+        die("socket");
+    serverSocketPath(&addr);
+    if (!serverSocketDirOk(addr.sun_path, 1))
+    {
+        errno = EPERM;
+        die("socket directory");
+    }
+    unlink(addr.sun_path); // stale socket from a previous server
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(lfd, 8) == -1)
+        die("bind");
+
+    signal(SIGPIPE, SIG_IGN); // a vanished client shows up as a write error instead
+    initDocument();
+    E.server = 1;
+    serverlfd = lfd;
+    printf("bitpad: serving on %s\n", addr.sun_path);
+    fflush(stdout);
+
+    while (1)
+    {
+        struct serverHello h;
+        int conn = accept(lfd, NULL, NULL);
+        if (conn == -1)
+            continue;
+        if (!serverPeerOk(conn))
+        {
+            close(conn);
+            continue;
+        }
+
+        if (recv(conn, &h, sizeof(h), MSG_WAITALL) != sizeof(h) ||
+            memcmp(h.magic, SERVER_MAGIC, sizeof(h.magic)) != 0 || h.rows < 3 || h.cols < 1)
+        {
+            close(conn);
+            continue;
+        }
+        h.path[sizeof(h.path) - 1] = '\0';
+
+        E.infd = E.outfd = conn;
+        E.screenrows = h.rows - 2;
+        E.screencols = h.cols;
+        E.syncoutput = h.syncoutput;
+
+        int i = editorBufferFind(h.path), r = 0;
+        if (i >= 0) // already loaded (or an unloaded stub, read back through the index)
+            r = editorBufferActivate(i);
+        else if (access(h.path, F_OK) != 0)
+            E.filename = strdup(h.path); // new file, created on first save
+        else
+            r = editorOpen(h.path, 0);
+        if (r == -1) // refuse the session, the server and its buffers carry on
+        {
+            char msg[PATH_MAX + 64];
+            int n = snprintf(msg, sizeof(msg), "bitpad: can't open %s: %s\r\n", h.path, strerror(errno));
+            editorWriteAll(conn, msg, n < (int)sizeof(msg) ? n : (int)sizeof(msg) - 1);
+            close(conn);
+            continue;
+        }
+        editorSetStatusMessage("HELP: Ctl+S = save | Ctl+Q = detach (%d other buffers loaded)", numbuffers);
+
+        if (setjmp(sessionEnd) == 0)
+        {
+            while (1)
+            {
+                editorCheckDisk();
+                editorRefreshScreen();
+                editorProcessKeypress();
+            }
+        }
+
+        free(promptbuf); // the client left while a prompt was up
+        promptbuf = NULL;
+        close(conn);
+        editorBufferPark();
+        editorBufferEvict();
+    }
+}
+
+void clientWinch(int sig)
+{
+    (void)sig;
+    winchanged = 1;
+}
+
+int editorClient(const char *filename) // returns -1 if there is no server to talk to, 1 if it refused
+{
+    struct sockaddr_un addr;
+    struct serverHello h;
+    struct stat st;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    serverSocketPath(&addr);
+    if (fd == -1 || lstat(addr.sun_path, &st) == -1)
+        return -1;
+    if (!S_ISSOCK(st.st_mode) || st.st_uid != getuid() || !serverSocketDirOk(addr.sun_path, 0))
+    {
+        fprintf(stderr, "bitpad: %s is not a socket of yours, not connecting\n", addr.sun_path);
+        return 1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+        return -1;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SERVER_MAGIC, sizeof(h.magic));
+    if (realpath(filename, h.path) == NULL) // not there yet, the server creates it on save
+    {
+        char cwd[PATH_MAX / 2];
+        if (filename[0] == '/' || getcwd(cwd, sizeof(cwd)) == NULL)
+            snprintf(h.path, sizeof(h.path), "%s", filename);
+        else
+            snprintf(h.path, sizeof(h.path), "%s/%s", cwd, filename);
+    }
+
+    enableRawMode();
+    int rows, cols;
+    if (getWindowSize(&rows, &cols) == -1)
+        die("getWindowSize");
+    h.rows = rows;
+    h.cols = cols;
+    h.syncoutput = editorDetectSyncOutput();
+    signal(SIGPIPE, SIG_IGN);
+    editorWriteAll(fd, (char *)&h, sizeof(h)); // a busy server may have answered and hung up already, read why below
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = clientWinch; // no SA_RESTART, poll has to wake up
+    sigaction(SIGWINCH, &sa, NULL);
+
+    char buf[4096];
+    int started = 0, refused = 0;
+    while (1)
+    {
+        struct pollfd pfd[2] = {{STDIN_FILENO, POLLIN, 0}, {fd, POLLIN, 0}};
+
+        if (winchanged)
+        {
+            winchanged = 0;
+            if (getWindowSize(&rows, &cols) == 0)
+            {
+                int n = snprintf(buf, sizeof(buf), "\x1b[8;%d;%dt", rows, cols);
+                editorWriteAll(fd, buf, n);
+            }
+        }
+
+        if (poll(pfd, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            die("poll");
+        }
+
+        if (pfd[0].revents & POLLIN)
+        {
+            ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+            if (n > 0 && editorWriteAll(fd, buf, n) == -1)
+                break;
+        }
+        if (pfd[1].revents & (POLLIN | POLLHUP))
+        {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n <= 0) // server ended the session
+                break;
+            if (!started && n >= 8 && memcmp(buf, "bitpad: ", 8) == 0) // no session, just why
+            {
+                editorWriteAll(STDERR_FILENO, buf, n);
+                refused = 1;
+                break;
+            }
+            started = 1;
+            editorWriteAll(STDOUT_FILENO, buf, n);
+        }
+    }
+
+    close(fd);
+    if (refused)
+        return 1;
+    write(STDOUT_FILENO, "\x1b[2J", 4);
+    write(STDOUT_FILENO, "\x1b[H", 3);
+    return 0;
+}
+
 int main(int argc, char *argv[]) // argument count, argument vector(array of strings)
 {
+    int hex = 0;
+
+    if (argc >= 2 && strcmp(argv[1], "-s") == 0) // ./bitpad -s [budget MB]: run the buffer server
+    {
+        long mb = argc >= 3 ? atol(argv[2]) : BUFFER_BUDGET_MB;
+        editorServe((size_t)(mb > 0 ? mb : BUFFER_BUDGET_MB) << 20);
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "-c") == 0) // ./bitpad -c file: open file in the running server
+    {
+        int r = editorClient(argv[2]);
+        if (r == -1)
+            fprintf(stderr, "bitpad: no server running (start one with %s -s)\n", argv[0]);
+        return r != 0;
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "-x") == 0) // ./bitpad -x file: hex view even if it looks like text
+    {
+        hex = 1;
+        argv++;
+        argc--;
+    }
+
     enableRawMode();
     initEditor();
     if (argc >= 2) // pass filename to view it after ./kilo
     {
-        editorOpen(argv[1]);
+        if (editorOpen(argv[1], hex) == -1)
+            die("fopen");
     }
 
-    editorSetStatusMessage("HELP: Ctl+S = save | Ctl+Q = quit");
+    if (E.statusmsg[0] == '\0') // editorOpen may have something more important to say
+        editorSetStatusMessage("HELP: Ctl+S = save | Ctl+Q = quit | Ctl+G = go to | Ctl+B = bracket | Ctl+K = fold");
 
     while (1)
     {
+        editorCheckDisk();
         editorRefreshScreen();
         editorProcessKeypress();
     }
 
     return 0;
-}
\ No newline at end of file
+}